@@ -8,6 +8,7 @@
  * 	2013-2017
  * ********************************************************************/
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -16,24 +17,84 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <unistd.h>
+#include <limits.h>
+#include <time.h>
 #include <rdma/fabric.h>
 #include <rdma/fi_domain.h>
 #include <rdma/fi_endpoint.h>
 #include <rdma/fi_cm.h>
+#include <rdma/fi_eq.h>
 #include <rdma/fi_tagged.h>
 #include <rdma/fi_rma.h>
 #include <rdma/fi_atomic.h>
 #include <rdma/fi_errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <signal.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #define MAX_NUM_CHANNELS    80
 #define TEST_MSG	    0
 #define TEST_RMA	    1
 #define TEST_ATOMIC	    2
+#define TEST_IOV	    3
+#define TEST_INCAST	    4
+#define TEST_ALLTOALL	    5
+#define TEST_ALLREDUCE	    6
+#define TEST_BCAST	    7
+#define TEST_TAGMATCH	    8
+#define TEST_MRECV	    9
+
+/* tests that register memory and count remote writes */
+#define RMA_TEST(t)	    ((t) == TEST_RMA || (t) == TEST_ATOMIC || (t) == TEST_IOV || \
+			     (t) == TEST_BCAST)
+
+/* tests that only run with -N */
+#define RANK_TEST(t)	    ((t) == TEST_INCAST || (t) == TEST_ALLTOALL || (t) == TEST_ALLREDUCE || \
+			     (t) == TEST_BCAST)
+
+#define LAYOUT_EP	    0	/* one endpoint per channel */
+#define LAYOUT_SEP	    1	/* one tx/rx context pair of a scalable endpoint per channel */
+#define LAYOUT_SHARED	    2	/* one endpoint per channel on shared tx/rx contexts */
+
+#define A2A_NAIVE	    0	/* all-to-all schedules */
+#define A2A_PAIRWISE	    1
+#define A2A_BRUCK	    2
+#define A2A_NUM		    3
+
+static const char *a2a_name[A2A_NUM] = {
+	"naive", "pairwise", "bruck"
+};
 
 #define MIN_MSG_SIZE        (1)
 #define MAX_MSG_SIZE        (1<<22)
 #define ALIGN               (1<<12)
 #define MSG_TAG		    (0xFFFF0000FFFF0000ULL)
+#define MAX_WINDOW	    256
+#define MAX_IOV		    64
+#define TM_MAX_DEPTH	    1024	/* outstanding tagged receives, tagmatch only */
+#define SOAK_SUB_BITS	    3		/* soak histogram buckets per power of 2 */
+#define SOAK_BUCKETS	    (64 << SOAK_SUB_BITS)
+#define SOAK_SLOTS	    4		/* soak intervals in flight */
+
+#define RESULT_NONE	    0
+#define RESULT_JSON	    1
+#define RESULT_CSV	    2
+
+/* per-op contexts, big enough for whichever the provider asks for */
+#ifdef FI_CONTEXT2
+typedef struct fi_context2	op_ctx_t;
+#define OP_CTX_MODE	    (FI_CONTEXT | FI_CONTEXT2)
+#else
+typedef struct fi_context	op_ctx_t;
+#define OP_CTX_MODE	    FI_CONTEXT
+#endif
+
+/* the API version of the headers, the most that can be asked for */
+#define HDR_VERSION	    FI_VERSION(FI_MAJOR_VERSION, FI_MINOR_VERSION)
 
 #define CHK_ERR(name, cond, err)							\
 	do {										\
@@ -47,11 +108,14 @@
 	do {										\
 		int err;								\
 		if (!opt.tag) {								\
-			err = fi_send(ep, buf, len, NULL, peer, context);		\
+			err = PHASE(PH_SEND,						\
+				    fi_send(ep, buf, len, NULL, peer, context));	\
 			CHK_ERR("fi_send", (err<0), err);				\
 		}									\
 		else {									\
-			err = fi_tsend(ep, buf, len, NULL, peer, MSG_TAG, context);	\
+			err = PHASE(PH_SEND,						\
+				    fi_tsend(ep, buf, len, NULL, peer,			\
+					     MSG_TAG, context));			\
 			CHK_ERR("fi_tsend", (err<0), err);				\
 		}									\
 	} while (0)
@@ -60,11 +124,14 @@
 	do {										\
 		int err;								\
 		if (!opt.tag) {								\
-			err = fi_recv(ep, buf, len, NULL, peer, context);		\
+			err = PHASE(PH_RECV,						\
+				    fi_recv(ep, buf, len, NULL, peer, context));	\
 			CHK_ERR("fi_recv", (err<0), err);				\
 		}									\
 		else {									\
-			err = fi_trecv(ep,buf,len,NULL,peer,MSG_TAG,0x0ULL,context);	\
+			err = PHASE(PH_RECV,						\
+				    fi_trecv(ep, buf, len, NULL, peer,			\
+					     MSG_TAG, 0x0ULL, context));		\
 			CHK_ERR("fi_trecv", (err<0), err);				\
 		}									\
 	} while (0)
@@ -74,7 +141,7 @@
 		struct fi_cq_tagged_entry entry[n];					\
 		int ret, completed = 0;							\
 		while (completed < n) {							\
-			ret = fi_cq_read(cq, entry, n);					\
+			ret = PHASE(PH_CQ, fi_cq_read(cq, entry, n));			\
 			if (ret == -FI_EAGAIN)						\
 				continue;						\
 			CHK_ERR("fi_cq_read", (ret<0), ret);				\
@@ -88,9 +155,92 @@ static struct {
 	int	bidir;
 	int	num_ch;
 	int	client;
+	int	window;
+	int	matrix;
+	int	contend;
+	int	layout;
+	int	threads;	/* one thread per channel */
+	int	self;		/* every channel targets itself */
+	int	generic;	/* no specialized loops */
+	int	ranks;		/* multi-rank mode, number of ranks */
+	int	rank;
+	int	fork;		/* start all ranks on this node */
+	int	schedule;	/* all-to-all schedule, -1 for all */
+	int	detect;		/* bisect for protocol switches */
+	int	ep_type;	/* FI_EP_RDM, FI_EP_MSG or FI_EP_DGRAM */
+	int	discover;	/* rank what fi_getinfo offers */
+	int	api_version;	/* FI_VERSION() asked for, 0 to negotiate */
+	int	no_context;	/* offer no FI_CONTEXT* mode */
+	int	verify;		/* check every payload */
 	char	*prov_name;
 	char	*server_name;
-} opt = { .num_ch = 1 };
+} opt = { .num_ch = 1, .schedule = -1, .ep_type = FI_EP_RDM };
+
+static struct {
+	int	*sizes;
+	int	num_sizes;
+	int	max_size;
+	int	iters;		/* fixed, or minimum when adaptive */
+	int	warmup;		/* untimed iterations before each point */
+	double	target_time;	/* us per point, adaptive */
+	double	target_ci;	/* relative 95% CI half-width, adaptive */
+} sweep;
+
+static size_t buf_size = MAX_MSG_SIZE;
+
+struct soak_acc {
+	uint64_t	n;
+	double		sum;		/* us */
+	double		max;
+	uint32_t	hist[SOAK_BUCKETS];
+};
+
+static struct {
+	double		duration;	/* us */
+	double		interval;	/* us */
+	struct soak_acc	(*acc)[SOAK_SLOTS + 1];	/* per thread, see soak_run() */
+	long		printed;	/* intervals printed so far */
+	long		errors;		/* verify errors at the last interval */
+} soak = { .interval = 1e6 };
+
+static struct {
+	int	format;
+	int	keep;		/* keep per-iteration samples */
+	char	*path;
+	FILE	*fp;
+	char	host[256];
+	char	start[32];
+	char	cmdline[1024];
+} result;
+
+struct baseline_rec {
+	char	test[64];
+	int	param;
+	size_t	size;
+	int	num_ch;
+	double	mean;		/* us */
+	double	*v;		/* sorted samples, us */
+	long	n;
+	int	used;
+};
+
+static struct {
+	char			*path;
+	double			threshold;	/* relative slowdown that counts */
+	struct baseline_rec	*recs;
+	int			num_recs;
+	char			provider[64];
+	int			warned;
+	int			compared;
+	int			regressed;
+	int			improved;
+	int			unmatched;
+} baseline = { .threshold = 0.05 };
+
+/* a per-op context alone on its cache line(s) */
+struct op_slot {
+	op_ctx_t	ctx;
+} __attribute__((aligned(64)));
 
 struct rma_info {
 	uint64_t	sbuf_addr;
@@ -102,45 +252,272 @@ struct rma_info {
 static struct fi_info		*fi;
 static struct fid_fabric	*fabric;
 static struct fid_domain	*domain;
-static struct fid_av		*av;
+static struct fid_av		*av;		/* unused for FI_EP_MSG */
+static struct fid_eq		*eq;		/* FI_EP_MSG only */
+static struct fid_pep		*pep;		/* FI_EP_MSG server only */
+static struct fid_ep		*sep;		/* LAYOUT_SEP only */
+static struct fid_stx		*stx;		/* LAYOUT_SHARED only */
+static struct fid_ep		*srx;		/* LAYOUT_SHARED only */
 
 static struct {
-	struct fid_ep		*ep;
+	struct fid_ep		*ep;		/* unused for LAYOUT_SEP */
+	struct fid_ep		*tx;		/* posts sends, RMA and atomics */
+	struct fid_ep		*rx;		/* posts receives */
 	struct fid_cq		*cq;
 	struct fid_cntr		*cntr;		/* unused for msg */
 	struct fid_mr		*smr;		/* unused for msg */
 	struct fid_mr		*rmr;		/* unused for msg */
 	struct rma_info 	peer_rma_info;	/* unused for msg */
 	fi_addr_t		peer_addr;
-	struct fi_context	sctxt;
-	struct fi_context	rctxt;
+	op_ctx_t		sctxt;
+	op_ctx_t		rctxt;
+	struct op_slot		pool[MAX_WINDOW];	/* contexts of ops in flight */
+	int			pfree[MAX_WINDOW];	/* stack of free pool slots */
+	int			nfree;
 	char			*sbuf;
 	char			*rbuf;
+	char			*bbuf;		/* bounce buffer, iov only */
+	struct iovec		siov[MAX_IOV];	/* iov only */
+	struct iovec		riov[MAX_IOV];	/* iov only */
 } ch[MAX_NUM_CHANNELS];
 
+/* channels driven by the calling thread, all of them unless opt.threads */
+static __thread int ch_first, ch_last;
+
+#define LEADER		    (ch_first == 0)
+
+/* both ends of every channel run the same side of each test */
+#define SYMMETRIC	    (opt.self || opt.ranks)
+
+static pthread_barrier_t thread_barrier;
+
+/****************************
+ *	Phase Counters
+ ****************************/
+
+/*
+ * Built with -DINSTRUMENT, the posting calls, CQ reads and counter reads
+ * of the msg and rma tests count their calls, -FI_EAGAIN returns and
+ * cycles into counters of the calling thread, and each msg and rma point
+ * prints where its time went. Otherwise PHASE() is the bare call.
+ */
+
+#define PH_SEND		    0
+#define PH_RECV		    1
+#define PH_RMA		    2		/* fi_write, fi_read */
+#define PH_CQ		    3
+#define PH_CNTR		    4
+#define NUM_PHASES	    5
+
+#ifdef INSTRUMENT
+
+static const char *phase_name[NUM_PHASES] = {
+	"send", "recv", "rma", "cq", "cntr"
+};
+
+struct phase_stat {
+	uint64_t	calls;
+	uint64_t	again;		/* -FI_EAGAIN, or no new count for cntr */
+	uint64_t	cycles;
+};
+
+/* per thread, at its ch_first */
+static struct {
+	struct phase_stat	s[NUM_PHASES];
+} __attribute__((aligned(64))) phase[MAX_NUM_CHANNELS];
+
+static struct phase_stat phase_last[NUM_PHASES];	/* leader: at the last report */
+
+#if defined(__x86_64__)
+#define PHASE_UNIT	    "cycles"
+static inline uint64_t phase_clock(void)
+{
+	return __builtin_ia32_rdtsc();
+}
+#else
+#define PHASE_UNIT	    "ns"
+static inline uint64_t phase_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+static inline void phase_add(int ph, int again, uint64_t t0)
+{
+	struct phase_stat *s = &phase[ch_first].s[ph];
+
+	s->calls++;
+	s->again += again;
+	s->cycles += phase_clock() - t0;
+}
+
+#define PHASE(ph, call)									\
+	({										\
+		uint64_t t0_ = phase_clock();						\
+		ssize_t ret_ = (call);							\
+		phase_add(ph, ret_ == -FI_EAGAIN, t0_);					\
+		ret_;									\
+	})
+
+/* a counter read that is still at done counts as -FI_EAGAIN */
+#define PHASE_CNTR(call, done)								\
+	({										\
+		uint64_t t0_ = phase_clock();						\
+		uint64_t ret_ = (call);							\
+		phase_add(PH_CNTR, ret_ <= (done), t0_);				\
+		ret_;									\
+	})
+
+/* leader: the phases of all threads since the last report */
+static void phase_report(void)
+{
+	struct phase_stat d[NUM_PHASES];
+	uint64_t total = 0;
+	int i, ph;
+
+	memset(d, 0, sizeof(d));
+	for (ph=0; ph<NUM_PHASES; ph++) {
+		for (i=0; i<opt.num_ch; i++) {
+			d[ph].calls += phase[i].s[ph].calls;
+			d[ph].again += phase[i].s[ph].again;
+			d[ph].cycles += phase[i].s[ph].cycles;
+		}
+		d[ph].calls -= phase_last[ph].calls;
+		d[ph].again -= phase_last[ph].again;
+		d[ph].cycles -= phase_last[ph].cycles;
+		phase_last[ph].calls += d[ph].calls;
+		phase_last[ph].again += d[ph].again;
+		phase_last[ph].cycles += d[ph].cycles;
+		total += d[ph].cycles;
+	}
+
+	for (ph=0; ph<NUM_PHASES; ph++) {
+		if (!d[ph].calls)
+			continue;
+		printf("\t%-4s %10" PRIu64 " calls, %5.1lf%% EAGAIN, %8.1lf %s/call, %5.1lf%%\n",
+			phase_name[ph], d[ph].calls, 100.0 * d[ph].again / d[ph].calls,
+			(double)d[ph].cycles / d[ph].calls, PHASE_UNIT,
+			total ? 100.0 * d[ph].cycles / total : 0.0);
+	}
+}
+
+#else
+
+#define PHASE(ph, call)		    (call)
+#define PHASE_CNTR(call, done)	    (call)
+
+static inline void phase_report(void)
+{
+}
+
+#endif
+
+/****************************
+ *	Context Pool
+ ****************************/
+
+/*
+ * Tests with many operations in flight take a context per operation from
+ * the channel's pool and give it back when the completion comes in,
+ * both in O(1): the free slots are a stack of indices and the slot of a
+ * completion follows from its op_context. ctx_reset() comes first and
+ * bounds the ops in flight. The pool belongs to the thread driving the
+ * channel.
+ */
+
+static inline void ctx_reset(int i, int n)
+{
+	int k;
+
+	/* slot 0 on top */
+	for (k=0; k<n; k++)
+		ch[i].pfree[k] = n - 1 - k;
+	ch[i].nfree = n;
+}
+
+/* call only while ch[i].nfree */
+static inline int ctx_get(int i)
+{
+	return ch[i].pfree[--ch[i].nfree];
+}
+
+static inline void ctx_put(int i, int slot)
+{
+	ch[i].pfree[ch[i].nfree++] = slot;
+}
+
+static inline op_ctx_t *ctx_of(int i, int slot)
+{
+	return &ch[i].pool[slot].ctx;
+}
+
+static inline int ctx_slot(int i, void *op_context)
+{
+	return (struct op_slot *)op_context - ch[i].pool;
+}
+
+/* op_context is one of the channel's pool contexts */
+static inline int ctx_owned(int i, void *op_context)
+{
+	return (struct op_slot *)op_context >= ch[i].pool &&
+	       (struct op_slot *)op_context < ch[i].pool + MAX_WINDOW;
+}
+
+/* give back the context of a completion */
+static inline void ctx_done(int i, void *op_context)
+{
+	ctx_put(i, ctx_slot(i, op_context));
+}
+
 /****************************
  *	Utility funcitons
  ****************************/
 
+static void barrier(void)
+{
+	if (opt.threads)
+		pthread_barrier_wait(&thread_barrier);
+}
+
 static double when(void)
 {
-	struct timeval tv;
-	static struct timeval tv0;
+	struct timespec ts;
+	static struct timespec ts0;
 	static int first = 1;
 	int err;
 
-	err = gettimeofday(&tv, NULL);
+	err = clock_gettime(CLOCK_MONOTONIC, &ts);
 	if (err) {
-		perror("gettimeofday");
+		perror("clock_gettime");
 		return 0;
 	}
 
 	if (first) {
-		tv0 = tv;
+		ts0 = ts;
 		first = 0;
 	}
-	return (double)(tv.tv_sec - tv0.tv_sec) * 1.0e6 + (double)(tv.tv_usec - tv0.tv_usec); 
-//	return (double)tv.tv_sec * 1.0e6 + (double)tv.tv_usec; 
+	return (double)(ts.tv_sec - ts0.tv_sec) * 1.0e6 + (double)(ts.tv_nsec - ts0.tv_nsec) / 1.0e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* the newest API both the headers and the library know, unless -V */
+static uint32_t api_version(void)
+{
+	uint32_t lib = fi_version();
+
+	if (opt.api_version)
+		return opt.api_version;
+	return lib < HDR_VERSION ? lib : HDR_VERSION;
 }
 
 static void print_options(void)
@@ -148,624 +525,5959 @@ static void print_options(void)
 	printf("test_type = %d (%s)\n", opt.test_type,
 			(opt.test_type == 0) ? "MSG" :
 			(opt.test_type == 1) ? "RMA" :
-			(opt.test_type == 2) ? "ATOMIC" : "UNKNOWN");
+			(opt.test_type == 2) ? "ATOMIC" :
+			(opt.test_type == 3) ? "IOV" :
+			(opt.test_type == 4) ? "INCAST" :
+			(opt.test_type == 5) ? "ALLTOALL" :
+			(opt.test_type == 6) ? "ALLREDUCE" :
+			(opt.test_type == 7) ? "BCAST" :
+			(opt.test_type == 8) ? "TAGMATCH" :
+			(opt.test_type == 9) ? "MRECV" : "UNKNOWN");
 	printf("tag = %d\n", opt.tag);
 	printf("bidir = %d\n", opt.bidir);
 	printf("num_ch = %d\n", opt.num_ch);
 	printf("client = %d\n", opt.client);
+	printf("window = %d\n", opt.window);
+	printf("matrix = %d\n", opt.matrix);
+	printf("contend = %d\n", opt.contend);
+	printf("layout = %d (%s)\n", opt.layout,
+			(opt.layout == LAYOUT_EP) ? "ep" :
+			(opt.layout == LAYOUT_SEP) ? "sep" : "shared");
+	printf("threads = %d\n", opt.threads);
+	printf("self = %d\n", opt.self);
+	printf("ranks = %d%s\n", opt.ranks, opt.fork ? " (forked)" : "");
+	printf("schedule = %s\n", opt.schedule < 0 ? "all" : a2a_name[opt.schedule]);
+	printf("loops = %s\n", opt.generic ? "generic" : "specialized");
+	printf("ep_type = %s\n", opt.ep_type == FI_EP_MSG ? "msg" :
+			opt.ep_type == FI_EP_DGRAM ? "dgram" : "rdm");
+	printf("discover = %d\n", opt.discover);
+	printf("api_version = %d.%d%s\n", FI_MAJOR(api_version()), FI_MINOR(api_version()),
+			opt.api_version ? "" : " (negotiated)");
+	printf("context = %s\n", opt.no_context ? "none" : "offered");
+	printf("verify = %d\n", opt.verify);
+	printf("detect = %d\n", opt.detect);
 	printf("prov_name = %s\n", opt.prov_name);
 	printf("server_name = %s\n", opt.server_name);
+	printf("sizes = %d (max %d)\n", sweep.num_sizes, sweep.max_size);
+	printf("iters = %d\n", sweep.iters);
+	printf("warmup = %d\n", sweep.warmup);
+	printf("target_time = %.0lf us\n", sweep.target_time);
+	printf("target_ci = %.2lf%%\n", sweep.target_ci * 100);
+	printf("soak = %.0lf s (interval %.0lf ms)\n", soak.duration / 1e6, soak.interval / 1e3);
+	printf("result = %s%s\n", result.format == RESULT_JSON ? "json:" :
+			result.format == RESULT_CSV ? "csv:" : "none",
+			result.path ? result.path : "");
+	printf("baseline = %s (threshold %.1lf%%)\n", baseline.path, baseline.threshold * 100);
 }
 
 /****************************
- *	Initialization
+ *	Baseline Comparison
  ****************************/
 
-static void init_buffer(void)
-{
-	int i;
-
-	for (i=0; i<opt.num_ch; i++) {
-		if (posix_memalign((void *) &ch[i].sbuf, ALIGN, MAX_MSG_SIZE)) {
-			fprintf(stderr, "No memory\n");
-			exit(1);
-		}
-
-		if (posix_memalign((void *) &ch[i].rbuf, ALIGN, MAX_MSG_SIZE)) {
-			fprintf(stderr, "No memory\n");
-			exit(1);
-		}
+#define BASELINE_Z2	    (1.96 * 1.96)	/* two-sided 5% level */
 
-		memset(ch[i].sbuf, 'a'+i, MAX_MSG_SIZE);
-		memset(ch[i].rbuf, 'o'+i, MAX_MSG_SIZE);
+/* value of "<key>": in a JSON line written by write_json() */
+static char *json_field(char *line, const char *key)
+{
+	char pat[80];
+	char *p;
 
-		ch[i].sbuf[MAX_MSG_SIZE - 1] = '\0';
-		ch[i].rbuf[MAX_MSG_SIZE - 1] = '\0';
-	}
+	snprintf(pat, sizeof(pat), "\"%s\":", key);
+	p = strstr(line, pat);
+	return p ? p + strlen(pat) : NULL;
 }
 
-static void free_buffer(void)
+static void load_baseline(void)
 {
-	int i;
+	struct baseline_rec *r;
+	char *line = NULL;
+	char *p, *end;
+	size_t cap = 0;
+	long max;
+	FILE *fp;
+
+	if (!baseline.path)
+		return;
 
-	for (i=0; i<opt.num_ch; i++) {
-		free(ch[i].sbuf);
-		free(ch[i].rbuf);
+	fp = fopen(baseline.path, "r");
+	if (!fp) {
+		perror(baseline.path);
+		exit(1);
 	}
-}
-
-static void init_fabric(void)
-{
-	struct fi_info		*hints;
-	struct fi_cq_attr	cq_attr;
-	struct fi_cntr_attr	cntr_attr;
-	struct fi_av_attr	av_attr;
-	int 			err;
-	int			version;
-	int			i;
 
-	hints = fi_allocinfo();
-	CHK_ERR("fi_allocinfo", (!hints), -ENOMEM);
+	while (getline(&line, &cap, fp) > 0) {
+		if (line[0] != '{') {
+			fprintf(stderr, "%s: not a JSON result file\n", baseline.path);
+			exit(1);
+		}
 
-	memset(&cq_attr, 0, sizeof(cq_attr));
-	memset(&cntr_attr, 0, sizeof(cntr_attr));
-	memset(&av_attr, 0, sizeof(av_attr));
+		baseline.recs = realloc(baseline.recs, (baseline.num_recs + 1) * sizeof(*r));
+		CHK_ERR("realloc", (!baseline.recs), -ENOMEM);
+		r = &baseline.recs[baseline.num_recs++];
+		memset(r, 0, sizeof(*r));
 
-	hints->ep_attr->type = FI_EP_RDM;
-	hints->caps = FI_MSG;
-	hints->mode = FI_CONTEXT;
-	hints->fabric_attr->prov_name = opt.prov_name;
+		p = json_field(line, "test");
+		if (!p || sscanf(p, "\"%63[^\"]\"", r->test) != 1)
+			goto bad;
 
-	if (opt.test_type == TEST_RMA)
-		hints->caps |= FI_RMA;
-	else if (opt.test_type == TEST_ATOMIC)
-		hints->caps |= FI_ATOMIC;
-	else if (opt.tag)
-		hints->caps |= FI_TAGGED;
+		if (!(p = json_field(line, "param")))
+			goto bad;
+		r->param = strtol(p, NULL, 10);
 
-	if (opt.test_type != TEST_MSG)
-		hints->caps |= FI_RMA_EVENT;
+		if (!(p = json_field(line, "size")))
+			goto bad;
+		r->size = strtoul(p, NULL, 10);
 
-	version = FI_VERSION(1, 0);
-	err = fi_getinfo(version, opt.server_name, "12345", 
-				(opt.client ? 0 : FI_SOURCE), hints, &fi);
-	CHK_ERR("fi_getinfo", (err<0), err);
+		if (!(p = json_field(line, "channels")))
+			goto bad;
+		r->num_ch = strtol(p, NULL, 10);
 
-	fi_freeinfo(hints);
+		p = json_field(line, "lat_us");
+		if (!p || !(p = json_field(p, "mean")))
+			goto bad;
+		r->mean = strtod(p, NULL);
 
-	printf("Using OFI device: %s\n", fi->fabric_attr->name);
+		p = json_field(line, "provider");
+		if (p && !baseline.provider[0])
+			sscanf(p, "\"%63[^\"]\"", baseline.provider);
 
-	err = fi_fabric(fi->fabric_attr, &fabric, NULL);
-	CHK_ERR("fi_fabric", (err<0), err);
+		p = json_field(line, "samples_us");
+		if (!p || *p++ != '[')
+			continue;
 
-	err = fi_domain(fabric, fi, &domain, NULL);
-	CHK_ERR("fi_domain", (err<0), err);
+		for (max = 0; *p != ']'; p = end + (*end == ',')) {
+			if (r->n == max) {
+				max = max ? max * 2 : 1024;
+				r->v = realloc(r->v, max * sizeof(double));
+				CHK_ERR("realloc", (!r->v), -ENOMEM);
+			}
+			r->v[r->n] = strtod(p, &end);
+			if (end == p)
+				goto bad;
+			r->n++;
+		}
+		qsort(r->v, r->n, sizeof(double), cmp_double);
+	}
 
-	av_attr.type = FI_AV_MAP;
+	free(line);
+	fclose(fp);
 
-	err = fi_av_open(domain, &av_attr, &av, NULL);
-	CHK_ERR("fi_av_open", (err<0), err);
+	printf("baseline: %d records from %s (%s)\n", baseline.num_recs, baseline.path,
+		baseline.provider[0] ? baseline.provider : "unknown provider");
+	return;
 
-	for (i=0; i<opt.num_ch; i++) {
-		cq_attr.format = FI_CQ_FORMAT_TAGGED;
-		cq_attr.size = 100;
+bad:
+	fprintf(stderr, "%s: malformed record %d\n", baseline.path, baseline.num_recs);
+	exit(1);
+}
 
-		err = fi_cq_open(domain, &cq_attr, &ch[i].cq, NULL);
-		CHK_ERR("fi_cq_open", (err<0), err);
+/*
+ * Mann-Whitney U test of the sorted samples a[] against the sorted
+ * samples b[] with the normal approximation and tie correction. Returns
+ * the probability that a sample of a[] is larger than one of b[] (0.5
+ * means no shift) and sets *sig if the shift is significant at the 5%
+ * level. The squared z is compared so no libm is needed.
+ */
+static double mann_whitney(const double *a, long na, const double *b, long nb, int *sig)
+{
+	double ra = 0, ties = 0, rank = 0;
+	double u, mu, var, t, v;
+	long i = 0, j = 0;
+	long ka, kb;
+
+	while (i < na || j < nb) {
+		v = (j == nb || (i < na && a[i] <= b[j])) ? a[i] : b[j];
+		for (ka = 0; i < na && a[i] == v; i++)
+			ka++;
+		for (kb = 0; j < nb && b[j] == v; j++)
+			kb++;
+
+		/* the tied group takes ranks rank+1 .. rank+t */
+		t = ka + kb;
+		ra += ka * (rank + (t + 1) / 2);
+		ties += t * t * t - t;
+		rank += t;
+	}
 
-		err = fi_endpoint(domain, fi, &ch[i].ep, NULL);
-		CHK_ERR("fi_endpoint", (err<0), err);
+	u = ra - (double)na * (na + 1) / 2;
+	mu = (double)na * nb / 2;
+	var = (double)na * nb / 12 *
+	      ((na + nb + 1) - ties / ((double)(na + nb) * (na + nb - 1)));
 
-		err = fi_ep_bind(ch[i].ep, (fid_t)ch[i].cq, FI_SEND|FI_RECV);
-		CHK_ERR("fi_ep_bind cq", (err<0), err);
+	*sig = var > 0 && (u - mu) * (u - mu) > BASELINE_Z2 * var;
+	return u / ((double)na * nb);
+}
 
-		err = fi_ep_bind(ch[i].ep, (fid_t)av, 0);
-		CHK_ERR("fi_ep_bind av", (err<0), err);
+/*
+ * Compare a point with the first unused baseline record of the same
+ * test, parameter and size. A point regresses when its mean latency is
+ * more than the threshold above the baseline and the samples are
+ * significantly shifted towards slower; bandwidth is derived from the
+ * same times, so it regresses with it. Without samples on either side
+ * only the threshold applies.
+ */
+static void compare_baseline(const char *test, int param, size_t size, double mean,
+			     const double *v, long n)
+{
+	struct baseline_rec *r = NULL;
+	const char *verdict;
+	double delta, slower = -1;
+	int sig = 1;
+	int k;
 
-		err = fi_enable(ch[i].ep);
-		CHK_ERR("fi_enable", (err<0), err);
+	if (!baseline.path)
+		return;
 
-		if (opt.test_type == TEST_MSG)
-			continue;
+	for (k=0; k<baseline.num_recs && !r; k++)
+		if (!baseline.recs[k].used && baseline.recs[k].param == param &&
+		    baseline.recs[k].size == size && !strcmp(baseline.recs[k].test, test))
+			r = &baseline.recs[k];
 
-		err = fi_mr_reg(domain, ch[i].sbuf, MAX_MSG_SIZE, FI_REMOTE_READ,
-				0, i+i+1, 0, &ch[i].smr, NULL);
-		CHK_ERR("fi_mr_reg", (err<0), err);
+	if (!r || r->mean <= 0) {
+		printf("\tvs baseline: no matching record\n");
+		baseline.unmatched++;
+		return;
+	}
+	r->used = 1;
 
-		/* read & write permission needed for fetch_atomic */
-		err = fi_mr_reg(domain, ch[i].rbuf, MAX_MSG_SIZE,
-				FI_REMOTE_READ | FI_REMOTE_WRITE,
-				0, i+i+2, 0, &ch[i].rmr, NULL);
-		CHK_ERR("fi_mr_reg", (err<0), err);
+	if (!baseline.warned && (r->num_ch != opt.num_ch ||
+	    strcmp(baseline.provider, fi->fabric_attr->prov_name))) {
+		printf("baseline: warning: recorded with %d channels on %s\n",
+			r->num_ch, baseline.provider);
+		baseline.warned = 1;
+	}
 
-		err = fi_cntr_open(domain, &cntr_attr, &ch[i].cntr, NULL);
-		CHK_ERR("fi_cntr_open", (err<0), err);
+	delta = (mean - r->mean) / r->mean;
+	if (n && r->n)
+		slower = mann_whitney(v, n, r->v, r->n, &sig);
 
-		err = fi_ep_bind(ch[i].ep, (fid_t)ch[i].cntr, FI_REMOTE_WRITE);
-		CHK_ERR("fi_ep_bind cntr", (err<0), err);
+	if (sig && delta > baseline.threshold && (slower < 0 || slower > 0.5)) {
+		verdict = "REGRESSION";
+		baseline.regressed++;
+	}
+	else if (sig && delta < -baseline.threshold && (slower < 0 || slower < 0.5)) {
+		verdict = "improved";
+		baseline.improved++;
+	}
+	else if (sig) {
+		verdict = "within threshold";
 	}
+	else {
+		verdict = "no significant change";
+	}
+	baseline.compared++;
+
+	printf("\tvs baseline: %8.2lf -> %8.2lf us (%+6.1lf%%), bw %+6.1lf%%, ",
+		r->mean, mean, delta * 100, (r->mean / mean - 1) * 100);
+	if (slower >= 0)
+		printf("P(slower) %.2lf, %s\n", slower, verdict);
+	else
+		printf("%s\n", verdict);
 }
 
-static finalize_fabric(void)
+/* returns the number of regressed points */
+static int finalize_baseline(void)
 {
-	int i;
+	int regressed = baseline.regressed;
+	int k;
 
-	for (i=0; i<opt.num_ch; i++) {
-		if (opt.test_type != TEST_MSG) {
-			fi_close((fid_t)ch[i].cntr);
-			fi_close((fid_t)ch[i].rmr);
-			fi_close((fid_t)ch[i].smr);
-		}
+	if (!baseline.path)
+		return 0;
 
-		fi_close((fid_t)ch[i].ep);
-		fi_close((fid_t)ch[i].cq);
+	for (k=0; k<baseline.num_recs; k++) {
+		if (!baseline.recs[k].used)
+			baseline.unmatched++;
+		free(baseline.recs[k].v);
 	}
+	free(baseline.recs);
 
-	fi_close((fid_t)av);
-	fi_close((fid_t)domain);
-	fi_close((fid_t)fabric);
-	fi_freeinfo(fi);
+	printf("baseline: %d compared, %d regressed, %d improved, %d unmatched (threshold %.1lf%%)\n",
+		baseline.compared, baseline.regressed, baseline.improved, baseline.unmatched,
+		baseline.threshold * 100);
+
+	return regressed;
 }
 
-static void get_peer_address(void)
-{
-	struct { char raw[16]; }	bound_addr, partner_addr;
-	size_t				bound_addrlen;
-	int				err;
-	int				ret;
-	int				i;
+/****************************
+ *	Result Output
+ ****************************/
 
-	if (opt.client) {
-		/* get the address of peer channel 0 */
-		if (!fi->dest_addr) {
-			fprintf(stderr, "couldn't get server address\n");
-			exit(1);
-		}
-		memcpy(&partner_addr, fi->dest_addr, fi->dest_addrlen);
+#define MAX_SAMPLES	    (1<<16)
+
+/*
+ * Per-iteration times of the current point, overall and per channel,
+ * kept only when results are written or compared. A channel's time is taken from the
+ * last completion it saw in the iteration; beyond MAX_SAMPLES iterations
+ * only the mean is updated. The per-channel times need the leader to
+ * see every channel's completions in the iteration it times, so they
+ * are not kept with -P, where other threads drive the channels, nor
+ * when a specialized loop runs, which takes no stamps. The clock reads
+ * for the samples and stamps fall inside the timed iterations, so a
+ * point with samples takes slightly longer than one without.
+ */
+static struct {
+	double	*v;
+	double	*ch[MAX_NUM_CHANNELS];
+	long	n;
+	int	per_ch;		/* ch[] is kept for this point */
+} samples;
 
-		ret = fi_av_insert(av, &partner_addr, 1, &ch[0].peer_addr, 0, NULL);
-		CHK_ERR("fi_av_insert", (ret!=1), ret);
+static double ch_stamp[MAX_NUM_CHANNELS];
 
-		/* send all my local addresses to peer channel 0 */
-		for (i=0; i<opt.num_ch; i++) {
-			bound_addrlen = sizeof(bound_addr);
-			err = fi_getname((fid_t)ch[i].ep, &bound_addr, &bound_addrlen);
-			CHK_ERR("fi_getname", (err<0), err);
+#define STAMP(i)									\
+	do {										\
+		if (samples.per_ch)							\
+			ch_stamp[i] = when();						\
+	} while (0)
 
-			SEND_MSG(ch[0].ep, &bound_addr, bound_addrlen,
-					ch[0].peer_addr, &ch[0].sctxt);
+struct lat_stats {
+	long	n;
+	double	mean, min, p50, p90, p99, p999, max;
+};
 
-			WAIT_CQ(ch[0].cq, 1);
-		}
+/* <spec> is json:<file> or csv:<file>, "-" for stdout */
+static void parse_result_spec(const char *spec)
+{
+	if (strncmp(spec, "json:", 5) == 0)
+		result.format = RESULT_JSON;
+	else if (strncmp(spec, "csv:", 4) == 0)
+		result.format = RESULT_CSV;
+	else {
+		fprintf(stderr, "Invalid result output '%s'\n", spec);
+		exit(1);
+	}
+	result.path = strdup(strchr(spec, ':') + 1);
+}
 
-		/* receive peer addresses except channel 0 */
-		for (i=1; i<opt.num_ch; i++) {
-			RECV_MSG(ch[i].ep, &partner_addr, sizeof(partner_addr),
-				 0, &ch[i].rctxt);
+static void init_result(int argc, char *argv[])
+{
+	time_t now;
+	size_t len = 0;
+	int i;
 
-			WAIT_CQ(ch[i].cq, 1);
+	result.keep = result.format || baseline.path || opt.ranks;
+	if (!result.keep)
+		return;
 
-			ret = fi_av_insert(av, &partner_addr, 1, &ch[i].peer_addr, 0, NULL);
-			CHK_ERR("fi_av_insert", (ret!=1), ret);
+	if (result.format && !result.fp) {
+		result.fp = fopen(result.path, "w");
+		if (!result.fp) {
+			perror(result.path);
+			exit(1);
 		}
-	} else {
-		/* receive all peer addresses from channel 0 */
-		for (i=0; i<opt.num_ch; i++) {
-			RECV_MSG(ch[0].ep, &partner_addr, sizeof(partner_addr),
-				 0, &ch[0].rctxt);
+	}
 
-			WAIT_CQ(ch[0].cq, 1);
+	samples.v = malloc(MAX_SAMPLES * sizeof(double));
+	CHK_ERR("malloc", (!samples.v), -ENOMEM);
+	for (i=0; i<opt.num_ch; i++) {
+		samples.ch[i] = malloc(MAX_SAMPLES * sizeof(double));
+		CHK_ERR("malloc", (!samples.ch[i]), -ENOMEM);
+	}
 
-			ret = fi_av_insert(av, &partner_addr, 1, &ch[i].peer_addr, 0, NULL);
-			CHK_ERR("fi_av_insert", (ret!=1), ret);
-		}
+	if (gethostname(result.host, sizeof(result.host)))
+		strcpy(result.host, "unknown");
+	result.host[sizeof(result.host) - 1] = '\0';
 
-		/* send all my local addresses (except channle 0) to peer */
-		for (i=1; i<opt.num_ch; i++) {
-			bound_addrlen = sizeof(bound_addr);
-			err = fi_getname((fid_t)ch[i].ep, &bound_addr, &bound_addrlen);
-			CHK_ERR("fi_getname", (err<0), err);
+	now = time(NULL);
+	strftime(result.start, sizeof(result.start), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
 
-			SEND_MSG(ch[i].ep, &bound_addr, bound_addrlen,
-					ch[i].peer_addr, &ch[i].sctxt);
+	for (i=0; i<argc && len < sizeof(result.cmdline); i++)
+		len += snprintf(result.cmdline + len, sizeof(result.cmdline) - len,
+				"%s%s", i ? " " : "", argv[i]);
 
-			WAIT_CQ(ch[i].cq, 1);
-		}
-	}
+	if (result.format == RESULT_CSV)
+		fprintf(result.fp, "test,param,size,iters,channels,channel,tagged,bidir,role,"
+			"provider,prov_version,fabric,domain,libfabric,host,start,cmdline,"
+			"samples,lat_mean,lat_min,lat_p50,lat_p90,lat_p99,lat_p999,lat_max,"
+			"bw_mbps,agg_bw_mbps\n");
 }
 
-/****************************
- *	MSG Test
- ****************************/
-
-static void send_one(int size)
+static void finalize_result(void)
 {
 	int i;
 
-	for (i=0; i<opt.num_ch; i++)
-		SEND_MSG(ch[i].ep, ch[i].sbuf, size, ch[i].peer_addr, &ch[i].sctxt);
+	if (!result.keep)
+		return;
+
+	if (result.fp)
+		fclose(result.fp);
 
+	free(samples.v);
 	for (i=0; i<opt.num_ch; i++)
-		WAIT_CQ(ch[i].cq, 1);
+		free(samples.ch[i]);
 }
 
-static void recv_one(int size)
+static inline void add_sample(double t1, double t)
 {
+	long n = samples.n;
 	int i;
 
-	for (i=0; i<opt.num_ch; i++)
-		RECV_MSG(ch[i].ep, ch[i].rbuf, size, ch[i].peer_addr, &ch[i].rctxt);
+	if (n >= MAX_SAMPLES)
+		return;
 
-	for (i=0; i<opt.num_ch; i++)
-		WAIT_CQ(ch[i].cq, 1);
+	samples.v[n] = t;
+	if (samples.per_ch)
+		for (i=0; i<opt.num_ch; i++)
+			samples.ch[i][n] = ch_stamp[i] >= t1 ? ch_stamp[i] - t1 : t;
+	samples.n++;
 }
 
-static void run_msg_test(void)
+/* sorts v in place */
+static void calc_stats(double *v, long n, double div, struct lat_stats *st)
 {
-	int size;
-	int i, n, repeat;
-	double t1, t2, t;
+	long k;
 
-	for (size = MIN_MSG_SIZE; size <= MAX_MSG_SIZE; size = size << 1) {
-		repeat = 1000;
-		n = size >> 16;
-		while (n) {
-			repeat >>= 1;
-			n >>= 1;
-		}
+	memset(st, 0, sizeof(*st));
+	st->n = n;
+	if (!n)
+		return;
 
-		printf("send/recv %-8d (x %4d): ", size, repeat);
-		fflush(stdout);
-		t1 = when();
-		for (i=0; i<repeat; i++) {
-			if (opt.client) {
-				recv_one(size);
-				send_one(size);
-			}
-			else {
-				send_one(size);
-				recv_one(size);
-			}
-		}
-		t2 = when();
-		t = (t2 - t1) / repeat / 2;
-		printf("%8.2lf us, %8.2lf MB/s\n", t, size/t);
+	qsort(v, n, sizeof(*v), cmp_double);
+	for (k=0; k<n; k++)
+		st->mean += v[k];
+	st->mean /= n * div;
+	st->min = v[0] / div;
+	st->p50 = v[n/2] / div;
+	st->p90 = v[n*9/10] / div;
+	st->p99 = v[n*99/100] / div;
+	st->p999 = v[n*999/1000] / div;
+	st->max = v[n-1] / div;
+}
+
+static void json_str(const char *name, const char *s)
+{
+	fprintf(result.fp, "\"%s\":\"", name);
+	for (; s && *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(result.fp, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(result.fp, "\\u%04x", *s);
+		else
+			fputc(*s, result.fp);
+	}
+	fprintf(result.fp, "\",");
+}
+
+static void csv_str(const char *s)
+{
+	fputc('"', result.fp);
+	for (; s && *s; s++) {
+		if (*s == '"')
+			fputc('"', result.fp);
+		fputc(*s, result.fp);
+	}
+	fprintf(result.fp, "\",");
+}
+
+static void json_stats(const struct lat_stats *st)
+{
+	fprintf(result.fp, "\"lat_us\":{\"samples\":%ld,\"mean\":%.3lf", st->n, st->mean);
+	if (st->n)
+		fprintf(result.fp, ",\"min\":%.3lf,\"p50\":%.3lf,\"p90\":%.3lf,"
+			"\"p99\":%.3lf,\"p999\":%.3lf,\"max\":%.3lf",
+			st->min, st->p50, st->p90, st->p99, st->p999, st->max);
+	fprintf(result.fp, "},");
+}
+
+static void csv_row(const char *test, int param, size_t size, int iters, int channel,
+		    const struct lat_stats *st, double bw, double agg_bw)
+{
+	uint32_t version = fi_version();
+	char buf[32];
+
+	csv_str(test);
+	fprintf(result.fp, "%d,%zu,%d,%d,", param, size, iters, opt.num_ch);
+	if (channel < 0)
+		fprintf(result.fp, "all,");
+	else
+		fprintf(result.fp, "%d,", channel);
+	fprintf(result.fp, "%d,%d,%s,", opt.tag, opt.bidir, opt.client ? "client" : "server");
+	csv_str(fi->fabric_attr->prov_name);
+	fprintf(result.fp, "%d.%d,", FI_MAJOR(fi->fabric_attr->prov_version),
+		FI_MINOR(fi->fabric_attr->prov_version));
+	csv_str(fi->fabric_attr->name);
+	csv_str(fi->domain_attr->name);
+	snprintf(buf, sizeof(buf), "%d.%d", FI_MAJOR(version), FI_MINOR(version));
+	csv_str(buf);
+	csv_str(result.host);
+	csv_str(result.start);
+	csv_str(result.cmdline);
+
+	fprintf(result.fp, "%ld,%.3lf,", st->n, st->mean);
+	if (st->n)
+		fprintf(result.fp, "%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,",
+			st->min, st->p50, st->p90, st->p99, st->p999, st->max);
+	else
+		fprintf(result.fp, ",,,,,,");
+	/* a single channel has no aggregate, agg_bw < 0 leaves it empty */
+	if (agg_bw < 0)
+		fprintf(result.fp, "%.3lf,\n", bw);
+	else
+		fprintf(result.fp, "%.3lf,%.3lf\n", bw, agg_bw);
+}
+
+static void write_json(const char *test, int param, size_t size, int iters,
+		       const struct lat_stats *agg, const struct lat_stats *chs, int nch,
+		       const double *v, long n)
+{
+	uint32_t version = fi_version();
+	long k;
+	int i;
+
+	fprintf(result.fp, "{");
+	json_str("test", test);
+	fprintf(result.fp, "\"param\":%d,\"size\":%zu,\"iters\":%d,\"channels\":%d,"
+		"\"tagged\":%d,\"bidir\":%d,", param, size, iters, opt.num_ch,
+		opt.tag, opt.bidir);
+	json_str("role", opt.client ? "client" : "server");
+	json_str("provider", fi->fabric_attr->prov_name);
+	fprintf(result.fp, "\"prov_version\":\"%d.%d\",",
+		FI_MAJOR(fi->fabric_attr->prov_version),
+		FI_MINOR(fi->fabric_attr->prov_version));
+	json_str("fabric", fi->fabric_attr->name);
+	json_str("domain", fi->domain_attr->name);
+	fprintf(result.fp, "\"libfabric\":\"%d.%d\",", FI_MAJOR(version), FI_MINOR(version));
+	json_str("host", result.host);
+	json_str("start", result.start);
+	json_str("cmdline", result.cmdline);
+	json_stats(agg);
+	fprintf(result.fp, "\"bw_mbps\":%.3lf,\"agg_bw_mbps\":%.3lf,\"per_channel\":[",
+		size / agg->mean, size * opt.num_ch / agg->mean);
+	for (i=0; i<nch; i++) {
+		fprintf(result.fp, "%s{\"channel\":%d,", i ? "," : "", i);
+		json_stats(&chs[i]);
+		fprintf(result.fp, "\"bw_mbps\":%.3lf}", size / chs[i].mean);
+	}
+	fprintf(result.fp, "],\"samples_us\":[");
+	for (k=0; k<n; k++)
+		fprintf(result.fp, "%s%.3lf", k ? "," : "", v[k]);
+	fprintf(result.fp, "]}\n");
+	fflush(result.fp);
+}
+
+/*
+ * Write one result record and compare it with the baseline. <t> is the
+ * average time per iteration as printed on the console (0 to use the
+ * mean of <v>); the <n> samples in <v> are divided by <div> like <t> was.
+ * With <per_ch> the per-channel samples of the current point are
+ * reported as well. JSON output is one object per line and includes the
+ * sorted samples, so it can serve as a baseline later; CSV output has one
+ * row for all channels followed by one row per channel.
+ */
+static void record(const char *test, int param, size_t size, int iters, double t,
+		   double *v, long n, int div, int per_ch)
+{
+	struct lat_stats agg, chs[MAX_NUM_CHANNELS];
+	int nch = per_ch && samples.per_ch ? opt.num_ch : 0;
+	long k;
+	int i;
+
+	if (!result.keep || !LEADER)
+		return;
+
+	calc_stats(v, n, div, &agg);
+	if (t)
+		agg.mean = t;
+
+	for (i=0; i<nch; i++)
+		calc_stats(samples.ch[i], n, div, &chs[i]);
+
+	/* v is sorted now; scale it like t for the output and the baseline */
+	for (k=0; k<n; k++)
+		v[k] /= div;
+
+	if (result.format == RESULT_CSV) {
+		csv_row(test, param, size, iters, -1, &agg, size / agg.mean,
+			size * opt.num_ch / agg.mean);
+		for (i=0; i<nch; i++)
+			csv_row(test, param, size, iters, i, &chs[i], size / chs[i].mean, -1);
+		fflush(result.fp);
 	}
+	else if (result.format == RESULT_JSON) {
+		write_json(test, param, size, iters, &agg, chs, nch, v, n);
+	}
+
+	compare_baseline(test, param, size, agg.mean, v, n);
+}
+
+/* record the point just timed by run_point() */
+static void record_point(const char *test, int param, size_t size, int iters, double t, int div)
+{
+	record(test, param, size, iters, t, samples.v, samples.n, div, 1);
 }
 
 /****************************
- *	RMA Test
+ *	Size Sweep
  ****************************/
 
-static void exchange_rma_info(void)
+typedef void (*iter_fn_t)(int size, int arg);
+typedef void (*loop_fn_t)(int size, int n);
+
+static loop_fn_t select_loop(iter_fn_t fn);
+
+#define POINT_LOCAL	    0	/* only this side runs the iterations */
+#define POINT_PAIRED	    1	/* both sides run the same iterations */
+#define MAX_POINT_TIME	    (10.0e6)
+#define MAX_BATCH	    1024
+#define SAMPLE_BATCH	    16		/* iterations per sample of a specialized loop */
+
+/* -1 beyond INT_MAX, which no size or step may reach */
+static long parse_size(const char *s, char **end)
 {
-	struct rma_info my_rma_info;
-	int i;
+	long v = strtol(s, end, 0);
+	int shift = 0;
 
-	if (fi->domain_attr->mr_mode == FI_MR_SCALABLE) {
-		for (i=0; i<opt.num_ch; i++) {
-			ch[i].peer_rma_info.sbuf_addr = 0ULL;
-			ch[i].peer_rma_info.sbuf_key = (uint64_t)(i+i+1);
-			ch[i].peer_rma_info.rbuf_addr = 0ULL;
-			ch[i].peer_rma_info.rbuf_key = (uint64_t)(i+i+2);
+	switch (**end) {
+	case 'k': case 'K': shift = 10; (*end)++; break;
+	case 'm': case 'M': shift = 20; (*end)++; break;
+	case 'g': case 'G': shift = 30; (*end)++; break;
+	}
+	if (v > (INT_MAX >> shift))
+		return -1;
+	return v << shift;
+}
+
+static void add_size(long size)
+{
+	if (size <= 0 || size > INT_MAX) {
+		fprintf(stderr, "Invalid message size %ld\n", size);
+		exit(1);
+	}
+
+	sweep.sizes = realloc(sweep.sizes, (sweep.num_sizes + 1) * sizeof(int));
+	CHK_ERR("realloc", (!sweep.sizes), -ENOMEM);
+
+	sweep.sizes[sweep.num_sizes++] = size;
+	if (size > sweep.max_size)
+		sweep.max_size = size;
+}
+
+/*
+ * <list> is a comma separated list of sizes and ranges. A range is
+ * <first>-<last>[:x<factor>|:+<step>] and doubles by default. Every
+ * number takes an optional k, m or g suffix.
+ */
+static void parse_sizes(const char *list)
+{
+	char *p = (char *)list;
+	char *end;
+	long first, last, step, size;
+	int geometric;
+
+	while (*p) {
+		first = last = parse_size(p, &end);
+		geometric = 1;
+		step = 2;
+		if (end != p && *end == '-') {
+			last = parse_size(end + 1, &end);
+			if (*end == ':') {
+				geometric = (end[1] == 'x');
+				if (!geometric && end[1] != '+')
+					goto bad;
+				step = parse_size(end + 2, &end);
+			}
 		}
-		return;
+
+		if (end == p || (*end && *end != ',') || first <= 0 || first > last ||
+		    step < (geometric ? 2 : 1))
+			goto bad;
+
+		/* both at most INT_MAX, so the next size still fits a long */
+		for (size = first; size <= last; size = geometric ? size * step : size + step)
+			add_size(size);
+
+		p = *end ? end + 1 : end;
 	}
+	return;
 
-	for (i=0; i<opt.num_ch; i++) {
-		my_rma_info.sbuf_addr = (uint64_t)ch[i].sbuf;
-		my_rma_info.sbuf_key = fi_mr_key(ch[i].smr);
-		my_rma_info.rbuf_addr = (uint64_t)ch[i].rbuf;
-		my_rma_info.rbuf_key = fi_mr_key(ch[i].rmr);
+bad:
+	fprintf(stderr, "Invalid size list '%s'\n", list);
+	exit(1);
+}
 
-		printf("my rma info: saddr=%llx skey=%llx raddr=%llx rkey=%llx\n",
-			my_rma_info.sbuf_addr, my_rma_info.sbuf_key,
-			my_rma_info.rbuf_addr, my_rma_info.rbuf_key);
+static void init_sweep(void)
+{
+	size_t need;
+	int size;
 
-		SEND_MSG(ch[i].ep, &my_rma_info, sizeof(my_rma_info),
-				ch[i].peer_addr, &ch[i].sctxt);
+	if (!sweep.num_sizes)
+		for (size = MIN_MSG_SIZE; size <= MAX_MSG_SIZE; size = size << 1)
+			add_size(size);
 
-		RECV_MSG(ch[i].ep, &ch[i].peer_rma_info, sizeof(ch[i].peer_rma_info),
-				0, &ch[i].rctxt);
+	/* the iov test spreads a message over twice its size */
+	need = (size_t)sweep.max_size * (opt.test_type == TEST_IOV ? 2 : 1);
+	if (need > buf_size)
+		buf_size = need;
+}
 
-		WAIT_CQ(ch[i].cq, 2);
+/* 1000 iterations, halved for every doubling of the size beyond 64KB */
+static int default_iters(size_t bytes)
+{
+	int repeat = 1000;
+	size_t n = bytes >> 16;
 
-		printf("peer rma info [%d]: saddr=%llx skey=%llx raddr=%llx rkey=%llx\n", i,
-			ch[i].peer_rma_info.sbuf_addr, ch[i].peer_rma_info.sbuf_key,
-			ch[i].peer_rma_info.rbuf_addr, ch[i].peer_rma_info.rbuf_key);
+	while (n && repeat > 1) {
+		repeat >>= 1;
+		n >>= 1;
 	}
+	return repeat;
 }
 
-static void synchronize(void)
+/* the client decides whether a paired point goes on, the server follows */
+static int sweep_agree(int cont)
 {
-	int dummy, dummy2;
 	int i;
 
-	for (i=0; i<opt.num_ch; i++) {
-		SEND_MSG(ch[i].ep, &dummy, sizeof(dummy), ch[i].peer_addr, &ch[i].sctxt);
-		RECV_MSG(ch[i].ep, &dummy2, sizeof(dummy2), 0, &ch[i].rctxt);
-		WAIT_CQ(ch[i].cq, 2);
+	/* rank 0 decides for all pairs */
+	if (opt.ranks) {
+		if (opt.rank) {
+			RECV_MSG(ch[0].rx, &cont, sizeof(cont), ch[0].peer_addr, &ch[0].rctxt);
+			WAIT_CQ(ch[0].cq, 1);
+			return cont;
+		}
+		for (i=0; i<opt.num_ch; i++) {
+			SEND_MSG(ch[i].tx, &cont, sizeof(cont), ch[i].peer_addr, &ch[i].sctxt);
+			WAIT_CQ(ch[i].cq, 1);
+		}
+		return cont;
 	}
 
-	printf("====================== sync =======================\n");
+	if (opt.client)
+		SEND_MSG(ch[0].tx, &cont, sizeof(cont), ch[0].peer_addr, &ch[0].sctxt);
+	else
+		RECV_MSG(ch[0].rx, &cont, sizeof(cont), ch[0].peer_addr, &ch[0].rctxt);
+
+	WAIT_CQ(ch[0].cq, 1);
+	return cont;
 }
 
-static void write_one(int size)
+/*
+ * sweep_agree() for code run by every thread: the client's leader
+ * decides and the value reaches all threads on both sides.
+ */
+static int leader_agree(int v)
 {
-	int ret;
-	int i;
+	static int shared;
+
+	if (LEADER)
+		shared = opt.self ? v : sweep_agree(v);
+	barrier();
+	v = shared;
+	barrier();
+	return v;
+}
 
-	for (i=0; i<opt.num_ch; i++) {
-		ret = fi_write(ch[i].ep, ch[i].sbuf, size, NULL, ch[i].peer_addr,
-				ch[i].peer_rma_info.rbuf_addr,
-				ch[i].peer_rma_info.rbuf_key, 
-				&ch[i].sctxt);
-		CHK_ERR("fi_write", (ret<0), ret);
+static int point_done(long iters, long n, double mean, double m2, double elapsed)
+{
+	double limit = sweep.target_time ? sweep.target_time : MAX_POINT_TIME;
+	double half;
 
-		WAIT_CQ(ch[i].cq, 1);
+	if (iters < sweep.iters)
+		return 0;
+
+	if (elapsed >= limit)
+		return 1;
+
+	if (sweep.target_ci && n >= 10) {
+		/* squared 95% half-width of the mean */
+		half = 1.96 * 1.96 * m2 / (n - 1) / n;
+		return half <= (sweep.target_ci * mean) * (sweep.target_ci * mean);
 	}
+
+	return 0;
 }
 
-static void read_one(int size)
+/*
+ * Time one point of a sweep and return the average time per iteration
+ * in us, with the number of timed iterations in *iters. sweep.warmup
+ * untimed iterations go first. Without a target time or confidence
+ * interval a fixed count is run; otherwise batches of doubling size are
+ * run until the target is met. The batch schedule does not depend on
+ * the measurements, so for paired points both sides stay in step and
+ * only the stop decision has to be exchanged. When results are written
+ * every timed iteration is also kept in samples; a specialized loop is
+ * timed SAMPLE_BATCH iterations at a time instead, so that the leader
+ * runs the same loop as everyone else, and each sample is the mean of
+ * its batch.
+ *
+ * With opt.threads every thread calls this for its own channel. The
+ * batches are fenced by barriers; the leader times them, decides when
+ * to stop and hands the result to the other threads through point.
+ */
+static struct {
+	int	cont;
+	int	iters;
+	double	t;
+} point;
+
+/* leader: the timed samples of the current point */
+static struct {
+	long	iters;
+	long	n;
+	double	mean, m2;	/* of the samples, per iteration */
+	double	elapsed;
+} pstat;
+
+static void time_batch(iter_fn_t fn, loop_fn_t loop, int size, int arg, int batch)
 {
-	int ret;
+	double t1, t, delta;
+	int i, k;
+
+	for (i=0; i<batch; i+=k) {
+		k = loop ? (batch - i < SAMPLE_BATCH ? batch - i : SAMPLE_BATCH) : 1;
+		t1 = when();
+		if (loop)
+			loop(size, k);
+		else
+			fn(size, arg);
+		t = when() - t1;
+		if (result.keep)
+			add_sample(t1, t / k);
+
+		pstat.iters += k;
+		pstat.n++;
+		delta = t / k - pstat.mean;
+		pstat.mean += delta / pstat.n;
+		pstat.m2 += delta * (t / k - pstat.mean);
+		pstat.elapsed += t;
+	}
+}
+
+static double run_point(iter_fn_t fn, int size, int arg, size_t bytes, int mode, int *iters)
+{
+	loop_fn_t loop = select_loop(fn);
+	double t1, t2;
+	int batch;
 	int i;
 
-	for (i=0; i<opt.num_ch; i++) {
-		ret = fi_read(ch[i].ep, ch[i].rbuf, size, NULL, ch[i].peer_addr,
-				ch[i].peer_rma_info.sbuf_addr,
-				ch[i].peer_rma_info.sbuf_key,
-				&ch[i].rctxt);
-		CHK_ERR("fi_readfrom", (ret<0), ret);
+	if (loop)
+		loop(size, sweep.warmup);
+	else
+		for (i=0; i<sweep.warmup; i++)
+			fn(size, arg);
 
-		WAIT_CQ(ch[i].cq, 1);
+	if (LEADER) {
+		samples.n = 0;
+		samples.per_ch = result.keep && !opt.threads && !loop;
+		memset(&pstat, 0, sizeof(pstat));
+	}
+
+	barrier();
+
+	if (!sweep.target_time && !sweep.target_ci) {
+		batch = sweep.iters ? sweep.iters : default_iters(bytes);
+		t1 = when();
+		if (result.keep && LEADER) {
+			time_batch(fn, loop, size, arg, batch);
+		}
+		else if (loop) {
+			loop(size, batch);
+		}
+		else {
+			for (i=0; i<batch; i++)
+				fn(size, arg);
+		}
+		barrier();
+		t2 = when();
+		if (LEADER) {
+			point.iters = batch;
+			point.t = (t2 - t1) / batch;
+		}
 	}
+	else {
+		batch = 1;
+		do {
+			if (LEADER) {
+				time_batch(fn, loop, size, arg, batch);
+			}
+			else if (loop) {
+				loop(size, batch);
+			}
+			else {
+				for (i=0; i<batch; i++)
+					fn(size, arg);
+			}
+			barrier();
+
+			if (LEADER) {
+				point.cont = !point_done(pstat.iters, pstat.n, pstat.mean,
+							 pstat.m2, pstat.elapsed);
+				if (mode == POINT_PAIRED && !opt.self)
+					point.cont = sweep_agree(point.cont);
+				point.iters = pstat.iters;
+				point.t = pstat.elapsed / pstat.iters;
+			}
+			barrier();
+
+			if (batch < MAX_BATCH)
+				batch <<= 1;
+		} while (point.cont);
+	}
+
+	barrier();
+	*iters = point.iters;
+	return point.t;
 }
 
-static inline void poll_one(int size)
+/****************************
+ *	Protocol Switch Detection
+ ****************************/
+
+#define SWITCH_MIN_STEP	    0.2		/* us */
+#define SWITCH_REL_STEP	    0.1		/* of the time below the step */
+#define SWITCH_MIN_GRAIN    8		/* bytes */
+
+/* time between two points beyond what the peak bandwidth accounts for */
+static double step_excess(int s0, double t0, int s1, double t1, double bw)
+{
+	return t1 - t0 - (s1 - s0) / bw;
+}
+
+/*
+ * -d: look for protocol switches (inject, eager -> rendezvous, ...) in
+ * the sweep of a paired test. An interval between neighbouring sizes
+ * whose time grows by more than the peak bandwidth explains is bisected
+ * down to SWITCH_MIN_GRAIN bytes or 1/64 of its size. The choice of the
+ * half follows the client's numbers, so both sides measure the same
+ * sizes. The points measured on the way are recorded with the sweep.
+ */
+static void find_switches(const char *name, iter_fn_t fn, int div,
+			  int n, const int *sizes, const double *ts)
 {
+	double bw = 0, t0, t1, tm, ex;
+	int lo, hi, mid, grain;
+	int k, repeat, found = 0;
+
+	for (k=0; k<n; k++)
+		if (sizes[k] / ts[k] > bw)
+			bw = sizes[k] / ts[k];
+
+	if (LEADER)
+		printf("%s: inject_size %zu, max_msg_size %zu, peak %.2lf MB/s\n",
+			name, fi->tx_attr->inject_size, fi->ep_attr->max_msg_size, bw);
+
+	/* neighbours in the order of -S, increasing sizes only */
+	for (k=0; k+1<n; k++) {
+		lo = sizes[k];
+		hi = sizes[k+1];
+		if (hi <= lo)
+			continue;
+
+		t0 = ts[k];
+		t1 = ts[k+1];
+		ex = step_excess(lo, t0, hi, t1, bw);
+		if (!leader_agree(ex > SWITCH_MIN_STEP && ex > SWITCH_REL_STEP * t0))
+			continue;
+
+		grain = lo / 64 > SWITCH_MIN_GRAIN ? lo / 64 : SWITCH_MIN_GRAIN;
+		while (hi - lo > grain) {
+			mid = lo + (hi - lo) / 2;
+			tm = run_point(fn, mid, 0, mid, POINT_PAIRED, &repeat) / div;
+			if (LEADER)
+				record_point(name, 0, mid, repeat, tm, div);
+
+			if (leader_agree(step_excess(lo, t0, mid, tm, bw) >=
+					 step_excess(mid, tm, hi, t1, bw))) {
+				hi = mid;
+				t1 = tm;
+			}
+			else {
+				lo = mid;
+				t0 = tm;
+			}
+		}
+
+		found++;
+		if (!LEADER)
+			continue;
+
+		printf("%s: switch between %d and %d bytes, %+.2lf us (%.2lf -> %.2lf us)%s\n",
+			name, lo, hi, step_excess(lo, t0, hi, t1, bw), t0, t1,
+			(lo <= (int)fi->tx_attr->inject_size && (int)fi->tx_attr->inject_size < hi) ?
+				", at inject_size" :
+			(lo <= (int)fi->ep_attr->max_msg_size && (int)fi->ep_attr->max_msg_size < hi) ?
+				", at max_msg_size" : "");
+	}
+
+	if (LEADER && !found)
+		printf("%s: no switch found\n", name);
+}
+
+
+/****************************
+ *	Multiple Ranks
+ ****************************/
+
+/*
+ * With opt.ranks every process is a rank with one channel per peer;
+ * channel k of rank r is paired with rank peer_rank(r, k). All pairs
+ * run the tests concurrently in both directions, the way opt.self runs
+ * them. Rank 0 listens on the well-known address, the other ranks pass
+ * its name like a client does.
+ */
+struct ep_addr {
+	char	raw[16];
+};
+
+static fi_addr_t rank0_addr;		/* the well-known endpoint of rank 0 */
+static int ready_pipe[2] = { -1, -1 };
+static pid_t rank_pid[MAX_NUM_CHANNELS + 1];
+
+static inline int peer_rank(int r, int k)
+{
+	return k < r ? k : k + 1;
+}
+
+static inline int peer_chan(int r, int p)
+{
+	return p < r ? p : p - 1;
+}
+
+/*
+ * -F: start ranks 1 .. opt.ranks-1 on this node. This is done before
+ * libfabric is initialized; the children wait on a pipe until rank 0
+ * has its endpoints open and only rank 0 writes to stdout.
+ */
+static void fork_ranks(void)
+{
+	char host[256];
+	char c;
 	int i;
 
-	for (i=0; i<opt.num_ch; i++) {
-		volatile char *p = ch[i].rbuf + size - 1;
-		while (*p != ('a'+i))
-			fi_cq_read(ch[i].cq, NULL, 0);
+	if (gethostname(host, sizeof(host))) {
+		perror("gethostname");
+		exit(1);
 	}
+	host[sizeof(host) - 1] = '\0';
+
+	CHK_ERR("pipe", (pipe(ready_pipe)), -errno);
+	fflush(stdout);
+
+	for (i=1; i<opt.ranks; i++) {
+		rank_pid[i] = fork();
+		CHK_ERR("fork", (rank_pid[i]<0), -errno);
+		if (rank_pid[i])
+			continue;
+
+		close(ready_pipe[1]);
+		if (read(ready_pipe[0], &c, 1) != 1)
+			exit(1);
+		close(ready_pipe[0]);
+
+		if (!freopen("/dev/null", "w", stdout))
+			exit(1);
+
+		opt.client = 1;
+		opt.server_name = strdup(host);
+		return;
+	}
+
+	close(ready_pipe[0]);
 }
 
-static inline void reset_one(int size)
+/* rank 0 of -F: the endpoints are open, let the other ranks in */
+static void release_ranks(void)
 {
 	int i;
 
-	for (i=0; i<opt.num_ch; i++)
-		ch[i].rbuf[size-1] = 'o' + i;
+	for (i=1; i<opt.ranks; i++)
+		CHK_ERR("write", (write(ready_pipe[1], "", 1) != 1), -errno);
+	close(ready_pipe[1]);
 }
 
-static inline wait_one(void)
+/* rank 0 of -F: the number of ranks that failed */
+static int wait_ranks(void)
 {
-	static uint64_t completed[MAX_NUM_CHANNELS];
-	uint64_t counter;
+	int status, failed = 0;
 	int i;
 
-	for (i=0; i<opt.num_ch; i++) {
-		while (1) {
-			counter = fi_cntr_read(ch[i].cntr);
-			if (counter > completed[i])
-				break;
-		}
-		completed[i]++;
+	for (i=1; i<opt.ranks; i++) {
+		if (waitpid(rank_pid[i], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status))
+			failed++;
 	}
+	return failed;
 }
 
-static void run_rma_test(void)
+/*
+ * The ranks send rank 0 the addresses of all their channels from their
+ * channel 0. Rank 0 numbers them in arrival order and returns to each
+ * its rank and, for every peer, the address of that peer's channel for
+ * it.
+ */
+static void get_rank_addresses(void)
 {
-	int size;
-	double t1, t2, t;
-	int repeat, i, n;
+	static struct ep_addr	table[MAX_NUM_CHANNELS + 1][MAX_NUM_CHANNELS];
+	struct ep_addr		mine[MAX_NUM_CHANNELS];
+	struct ep_addr		partner_addr;
+	struct {
+		int		rank;
+		struct ep_addr	addr[MAX_NUM_CHANNELS + 1];
+	} reply;
+	size_t			addrlen;
+	int			err;
+	int			ret;
+	int			i, r;
 
-	exchange_rma_info();
+	for (i=0; i<opt.num_ch; i++) {
+		addrlen = sizeof(mine[i]);
+		err = fi_getname((fid_t)ch[i].ep, &mine[i], &addrlen);
+		CHK_ERR("fi_getname", (err<0), err);
+	}
 
-	synchronize();
+	if (!opt.server_name) {
+		memcpy(table[0], mine, sizeof(mine));
+
+		for (r=1; r<opt.ranks; r++) {
+			RECV_MSG(ch[0].rx, table[r], sizeof(table[r]), FI_ADDR_UNSPEC,
+				 &ch[0].rctxt);
+			WAIT_CQ(ch[0].cq, 1);
 
-	for (size = MIN_MSG_SIZE; size <= MAX_MSG_SIZE; size = size << 1) {
-		repeat = 1000;
-		n = size >> 16;
-		while (n) {
-			repeat >>= 1;
-			n >>= 1;
+			/* rank r talks to rank 0 over its channel 0 */
+			ret = fi_av_insert(av, &table[r][0], 1, &ch[r-1].peer_addr, 0, NULL);
+			CHK_ERR("fi_av_insert", (ret!=1), ret);
 		}
 
-		printf("write %-8d (x %4d): ", size, repeat);
-		fflush(stdout);
-		t1 = when();
-		for (i=0; i<repeat; i++) {
-			if (opt.client) {
-				write_one(size);
-				//poll_one(size);
-				//reset_one(size);
-				if (opt.bidir)
-					wait_one();
-			}
-			else {
-				wait_one();
-				 if (opt.bidir) {
-					//poll_one(size);
-					//reset_one(size);
-					write_one(size);
-				}
-			}
+		for (r=1; r<opt.ranks; r++) {
+			reply.rank = r;
+			for (i=0; i<opt.ranks; i++)
+				if (i != r)
+					reply.addr[i] = table[i][peer_chan(i, r)];
+
+			SEND_MSG(ch[r-1].tx, &reply, sizeof(reply), ch[r-1].peer_addr,
+				 &ch[r-1].sctxt);
+			WAIT_CQ(ch[r-1].cq, 1);
 		}
-		t2 = when();
-		t = (t2 - t1) / repeat;
-		printf("%8.2lf us, %8.2lf MB/s\n", t, size/t);
+
+		opt.rank = 0;
+		printf("rank 0 of %d\n", opt.ranks);
+		return;
 	}
 
-	synchronize();
+	if (!fi->dest_addr) {
+		fprintf(stderr, "couldn't get rank 0 address\n");
+		exit(1);
+	}
+	memcpy(&partner_addr, fi->dest_addr, fi->dest_addrlen);
 
-	if (opt.client || opt.bidir) {
-		for (size = MIN_MSG_SIZE; size <= MAX_MSG_SIZE; size = size << 1) {
-			repeat = 1000;
-			n = size >> 16;
-			while (n) {
-				repeat >>= 1;
-				n >>= 1;
-			}
+	ret = fi_av_insert(av, &partner_addr, 1, &rank0_addr, 0, NULL);
+	CHK_ERR("fi_av_insert", (ret!=1), ret);
+
+	RECV_MSG(ch[0].rx, &reply, sizeof(reply), FI_ADDR_UNSPEC, &ch[0].rctxt);
+	SEND_MSG(ch[0].tx, mine, opt.num_ch * sizeof(mine[0]), rank0_addr, &ch[0].sctxt);
+	WAIT_CQ(ch[0].cq, 2);
+
+	opt.rank = reply.rank;
+	for (r=0; r<opt.ranks; r++) {
+		if (r == opt.rank)
+			continue;
+
+		i = peer_chan(opt.rank, r);
+		ret = fi_av_insert(av, &reply.addr[r], 1, &ch[i].peer_addr, 0, NULL);
+		CHK_ERR("fi_av_insert", (ret!=1), ret);
+	}
+
+	printf("rank %d of %d\n", opt.rank, opt.ranks);
+}
+
+/*
+ * Report the point just timed per pair: every rank sends rank 0 the
+ * mean time of each of its channels, and rank 0 prints one line per
+ * rank with the time to each peer, and the spread over all pairs.
+ */
+static void report_pairs(int div)
+{
+	double t[MAX_NUM_CHANNELS];
+	double sum = 0, min = 0, max = 0;
+	long k;
+	int i, r;
+
+	for (i=0; i<opt.num_ch; i++) {
+		t[i] = 0;
+		for (k=0; k<samples.n; k++)
+			t[i] += samples.ch[i][k];
+		t[i] /= samples.n ? samples.n * div : 1;
+	}
+
+	if (opt.rank) {
+		SEND_MSG(ch[0].tx, t, sizeof(t), ch[0].peer_addr, &ch[0].sctxt);
+		WAIT_CQ(ch[0].cq, 1);
+		return;
+	}
+
+	for (r=0; r<opt.ranks; r++) {
+		if (r) {
+			RECV_MSG(ch[r-1].rx, t, sizeof(t), ch[r-1].peer_addr, &ch[r-1].rctxt);
+			WAIT_CQ(ch[r-1].cq, 1);
+		}
+
+		printf("    rank %-3d", r);
+		for (i=0; i<opt.num_ch; i++) {
+			printf(" %3d:%8.2lf", peer_rank(r, i), t[i]);
+			if (!r && !i)
+				min = max = t[i];
+			min = t[i] < min ? t[i] : min;
+			max = t[i] > max ? t[i] : max;
+			sum += t[i];
+		}
+		printf("\n");
+	}
+
+	printf("    %d pairs: mean %8.2lf us, min %8.2lf us, max %8.2lf us\n",
+		opt.ranks * (opt.ranks - 1) / 2, sum / (opt.ranks * opt.num_ch), min, max);
+}
+
+/****************************
+ *	Initialization
+ ****************************/
+
+static void init_buffer(void)
+{
+	int i;
+
+	for (i=0; i<opt.num_ch; i++) {
+		if (posix_memalign((void *) &ch[i].sbuf, ALIGN, buf_size)) {
+			fprintf(stderr, "No memory\n");
+			exit(1);
+		}
+
+		if (posix_memalign((void *) &ch[i].rbuf, ALIGN, buf_size)) {
+			fprintf(stderr, "No memory\n");
+			exit(1);
+		}
+
+		memset(ch[i].sbuf, 'a'+i, buf_size);
+		memset(ch[i].rbuf, 'o'+i, buf_size);
+
+		ch[i].sbuf[buf_size - 1] = '\0';
+		ch[i].rbuf[buf_size - 1] = '\0';
+
+		if (opt.test_type != TEST_IOV)
+			continue;
+
+		if (posix_memalign((void *) &ch[i].bbuf, ALIGN, buf_size)) {
+			fprintf(stderr, "No memory\n");
+			exit(1);
+		}
+	}
+}
+
+static void free_buffer(void)
+{
+	int i;
+
+	for (i=0; i<opt.num_ch; i++) {
+		free(ch[i].sbuf);
+		free(ch[i].rbuf);
+		free(ch[i].bbuf);
+	}
+}
+
+/*
+ * The endpoint of channel i. For FI_EP_MSG this is done per connection,
+ * with the info of the connection request on the server side.
+ */
+static void open_ep(int i, struct fi_info *info)
+{
+	int err;
+
+	err = fi_endpoint(domain, info, &ch[i].ep, NULL);
+	CHK_ERR("fi_endpoint", (err<0), err);
+
+	if (opt.layout == LAYOUT_SHARED) {
+		err = fi_ep_bind(ch[i].ep, (fid_t)stx, 0);
+		CHK_ERR("fi_ep_bind stx", (err<0), err);
+
+		err = fi_ep_bind(ch[i].ep, (fid_t)srx, 0);
+		CHK_ERR("fi_ep_bind srx", (err<0), err);
+	}
+
+	err = fi_ep_bind(ch[i].ep, (fid_t)ch[i].cq, FI_SEND|FI_RECV);
+	CHK_ERR("fi_ep_bind cq", (err<0), err);
+
+	if (eq) {
+		err = fi_ep_bind(ch[i].ep, (fid_t)eq, 0);
+		CHK_ERR("fi_ep_bind eq", (err<0), err);
+	}
+	else {
+		err = fi_ep_bind(ch[i].ep, (fid_t)av, 0);
+		CHK_ERR("fi_ep_bind av", (err<0), err);
+	}
+
+	if (ch[i].cntr) {
+		err = fi_ep_bind(ch[i].ep, (fid_t)ch[i].cntr, FI_REMOTE_WRITE);
+		CHK_ERR("fi_ep_bind cntr", (err<0), err);
+	}
+
+	err = fi_enable(ch[i].ep);
+	CHK_ERR("fi_enable", (err<0), err);
+
+	/* receives go to the shared context, completions to ch[i].cq */
+	ch[i].tx = ch[i].ep;
+	ch[i].rx = (opt.layout == LAYOUT_SHARED) ? srx : ch[i].ep;
+}
+
+/* what the options ask of the provider */
+static struct fi_info *get_hints(void)
+{
+	struct fi_info		*hints;
+
+	hints = fi_allocinfo();
+	CHK_ERR("fi_allocinfo", (!hints), -ENOMEM);
+
+	hints->ep_attr->type = opt.ep_type;
+	hints->caps = FI_MSG;
+	hints->mode = opt.no_context ? 0 : OP_CTX_MODE;
+	hints->fabric_attr->prov_name = opt.prov_name;
+
+#if HDR_VERSION >= FI_VERSION(1, 5)
+	/* buffers are malloc'ed, addresses and keys are exchanged */
+	if (api_version() >= FI_VERSION(1, 5))
+		hints->domain_attr->mr_mode = FI_MR_VIRT_ADDR | FI_MR_ALLOCATED |
+					      FI_MR_PROV_KEY;
+#endif
+
+	if (opt.layout == LAYOUT_SEP) {
+		hints->ep_attr->tx_ctx_cnt = opt.num_ch;
+		hints->ep_attr->rx_ctx_cnt = opt.num_ch;
+	}
+	else if (opt.layout == LAYOUT_SHARED) {
+		hints->ep_attr->tx_ctx_cnt = FI_SHARED_CONTEXT;
+		hints->ep_attr->rx_ctx_cnt = FI_SHARED_CONTEXT;
+
+		/* all channels receive through one context, match by source */
+		hints->caps |= FI_DIRECTED_RECV;
+
+		/* the shared contexts are used by all threads */
+		if (opt.threads)
+			hints->domain_attr->threading = FI_THREAD_SAFE;
+	}
+
+	if (opt.test_type == TEST_RMA || opt.test_type == TEST_IOV ||
+	    opt.test_type == TEST_BCAST)
+		hints->caps |= FI_RMA;
+	else if (opt.test_type == TEST_ATOMIC)
+		hints->caps |= FI_ATOMIC;
+	else if (opt.tag)
+		hints->caps |= FI_TAGGED;
+
+	if (opt.test_type == TEST_MRECV)
+		hints->caps |= FI_MULTI_RECV;
+
+	if (RMA_TEST(opt.test_type))
+		hints->caps |= FI_RMA_EVENT;
+
+	/* the broadcast forwards a chunk once that many writes landed */
+	if (opt.test_type == TEST_BCAST) {
+		hints->tx_attr->msg_order = FI_ORDER_WAW;
+		hints->rx_attr->msg_order = FI_ORDER_WAW;
+	}
+
+	return hints;
+}
+
+/* open the fabric, domain and channels of fi */
+static void open_fabric(void)
+{
+	struct fi_cq_attr	cq_attr;
+	struct fi_cntr_attr	cntr_attr;
+	struct fi_av_attr	av_attr;
+	struct fi_eq_attr	eq_attr;
+	size_t			window = opt.window;	/* 0 .. MAX_WINDOW */
+	int 			err;
+	int			i;
+
+	memset(&cq_attr, 0, sizeof(cq_attr));
+	memset(&cntr_attr, 0, sizeof(cntr_attr));
+	memset(&av_attr, 0, sizeof(av_attr));
+	memset(&eq_attr, 0, sizeof(eq_attr));
+
+	printf("Using OFI device: %s\n", fi->fabric_attr->name);
+
+	if (window > fi->tx_attr->size) {
+		window = fi->tx_attr->size;
+		opt.window = window;
+		printf("window limited to tx_attr->size = %d\n", opt.window);
+	}
+
+	err = fi_fabric(fi->fabric_attr, &fabric, NULL);
+	CHK_ERR("fi_fabric", (err<0), err);
+
+	err = fi_domain(fabric, fi, &domain, NULL);
+	CHK_ERR("fi_domain", (err<0), err);
+
+	if (opt.ep_type == FI_EP_MSG) {
+		/* connections are made by get_peer_address() */
+		eq_attr.wait_obj = FI_WAIT_UNSPEC;
+		err = fi_eq_open(fabric, &eq_attr, &eq, NULL);
+		CHK_ERR("fi_eq_open", (err<0), err);
+
+		if (!opt.server_name) {
+			err = fi_passive_ep(fabric, fi, &pep, NULL);
+			CHK_ERR("fi_passive_ep", (err<0), err);
+
+			err = fi_pep_bind(pep, (fid_t)eq, 0);
+			CHK_ERR("fi_pep_bind", (err<0), err);
+
+			err = fi_listen(pep);
+			CHK_ERR("fi_listen", (err<0), err);
+		}
+	}
+	else {
+		av_attr.type = FI_AV_MAP;
+		if (opt.layout == LAYOUT_SEP)
+			av_attr.rx_ctx_bits = 8;
+
+		err = fi_av_open(domain, &av_attr, &av, NULL);
+		CHK_ERR("fi_av_open", (err<0), err);
+	}
+
+	if (opt.layout == LAYOUT_SEP) {
+		err = fi_scalable_ep(domain, fi, &sep, NULL);
+		CHK_ERR("fi_scalable_ep", (err<0), err);
+	}
+	else if (opt.layout == LAYOUT_SHARED) {
+		err = fi_stx_context(domain, fi->tx_attr, &stx, NULL);
+		CHK_ERR("fi_stx_context", (err<0), err);
+
+		err = fi_srx_context(domain, fi->rx_attr, &srx, NULL);
+		CHK_ERR("fi_srx_context", (err<0), err);
+	}
+
+	for (i=0; i<opt.num_ch; i++) {
+		cq_attr.format = FI_CQ_FORMAT_TAGGED;
+		cq_attr.size = 100;
+		if (window > cq_attr.size)
+			cq_attr.size = window;
+		if (opt.test_type == TEST_TAGMATCH)
+			cq_attr.size = TM_MAX_DEPTH + 2;
+
+		err = fi_cq_open(domain, &cq_attr, &ch[i].cq, NULL);
+		CHK_ERR("fi_cq_open", (err<0), err);
+
+		if (RMA_TEST(opt.test_type)) {
+			err = fi_mr_reg(domain, ch[i].sbuf, buf_size, FI_REMOTE_READ,
+					0, i+i+1, 0, &ch[i].smr, NULL);
+			CHK_ERR("fi_mr_reg", (err<0), err);
+
+			/* read & write permission needed for fetch_atomic */
+			err = fi_mr_reg(domain, ch[i].rbuf, buf_size,
+					FI_REMOTE_READ | FI_REMOTE_WRITE,
+					0, i+i+2, 0, &ch[i].rmr, NULL);
+			CHK_ERR("fi_mr_reg", (err<0), err);
+
+			err = fi_cntr_open(domain, &cntr_attr, &ch[i].cntr, NULL);
+			CHK_ERR("fi_cntr_open", (err<0), err);
+		}
+
+		if (opt.layout == LAYOUT_SEP) {
+			err = fi_tx_context(sep, i, NULL, &ch[i].tx, NULL);
+			CHK_ERR("fi_tx_context", (err<0), err);
+
+			err = fi_rx_context(sep, i, NULL, &ch[i].rx, NULL);
+			CHK_ERR("fi_rx_context", (err<0), err);
+
+			err = fi_ep_bind(ch[i].tx, (fid_t)ch[i].cq, FI_SEND);
+			CHK_ERR("fi_ep_bind cq", (err<0), err);
+
+			err = fi_ep_bind(ch[i].rx, (fid_t)ch[i].cq, FI_RECV);
+			CHK_ERR("fi_ep_bind cq", (err<0), err);
+
+			err = fi_ep_bind(ch[i].tx, (fid_t)av, 0);
+			CHK_ERR("fi_ep_bind av", (err<0), err);
+
+			if (ch[i].cntr) {
+				err = fi_ep_bind(ch[i].rx, (fid_t)ch[i].cntr, FI_REMOTE_WRITE);
+				CHK_ERR("fi_ep_bind cntr", (err<0), err);
+			}
+
+			err = fi_enable(ch[i].tx);
+			CHK_ERR("fi_enable", (err<0), err);
+
+			err = fi_enable(ch[i].rx);
+			CHK_ERR("fi_enable", (err<0), err);
+		}
+		else if (opt.ep_type != FI_EP_MSG) {
+			open_ep(i, fi);
+		}
+	}
+}
+
+static void init_fabric(void)
+{
+	struct fi_info		*hints;
+	int 			err;
+	int			version;
+
+	hints = get_hints();
+
+	version = api_version();
+	err = fi_getinfo(version, opt.server_name, "12345", 
+				(opt.server_name ? 0 : FI_SOURCE), hints, &fi);
+	if (err == -FI_ENODATA && hints->tx_attr->msg_order) {
+		/* unordered writes still run the unpipelined broadcast */
+		hints->tx_attr->msg_order = 0;
+		hints->rx_attr->msg_order = 0;
+		err = fi_getinfo(version, opt.server_name, "12345",
+				 (opt.server_name ? 0 : FI_SOURCE), hints, &fi);
+	}
+	CHK_ERR("fi_getinfo", (err<0), err);
+
+	fi_freeinfo(hints);
+
+	printf("API %d.%d, provider mode requires %s\n", FI_MAJOR(version), FI_MINOR(version),
+		(fi->mode & OP_CTX_MODE & ~FI_CONTEXT) ? "FI_CONTEXT2" :
+		(fi->mode & FI_CONTEXT) ? "FI_CONTEXT" : "no context");
+
+	open_fabric();
+}
+
+static finalize_fabric(void)
+{
+	int i;
+
+	for (i=0; i<opt.num_ch; i++) {
+		if (RMA_TEST(opt.test_type)) {
+			fi_close((fid_t)ch[i].cntr);
+			fi_close((fid_t)ch[i].rmr);
+			fi_close((fid_t)ch[i].smr);
+		}
+
+		if (opt.layout == LAYOUT_SEP) {
+			fi_close((fid_t)ch[i].tx);
+			fi_close((fid_t)ch[i].rx);
+		}
+		else {
+			fi_close((fid_t)ch[i].ep);
+		}
+		fi_close((fid_t)ch[i].cq);
+	}
+
+	if (pep)
+		fi_close((fid_t)pep);
+	if (eq)
+		fi_close((fid_t)eq);
+	if (sep)
+		fi_close((fid_t)sep);
+	if (srx)
+		fi_close((fid_t)srx);
+	if (stx)
+		fi_close((fid_t)stx);
+
+	if (av)
+		fi_close((fid_t)av);
+	fi_close((fid_t)domain);
+	fi_close((fid_t)fabric);
+	fi_freeinfo(fi);
+}
+
+/*
+ * A scalable endpoint has one address; the peer channels are told apart
+ * by their receive context index.
+ */
+static void get_sep_peer_address(void)
+{
+	struct { char raw[16]; }	bound_addr, partner_addr;
+	size_t				bound_addrlen;
+	fi_addr_t			sep_peer_addr;
+	int				err;
+	int				ret;
+	int				i;
+
+	if (opt.self) {
+		bound_addrlen = sizeof(partner_addr);
+		err = fi_getname((fid_t)sep, &partner_addr, &bound_addrlen);
+		CHK_ERR("fi_getname", (err<0), err);
+	}
+	else if (opt.client) {
+		/* get the address of peer sep */
+		if (!fi->dest_addr) {
+			fprintf(stderr, "couldn't get server address\n");
+			exit(1);
+		}
+		memcpy(&partner_addr, fi->dest_addr, fi->dest_addrlen);
+	}
+	else {
+		/* receive peer sep addresses from channel 0 */
+		RECV_MSG(ch[0].rx, &partner_addr, sizeof(partner_addr),
+			 FI_ADDR_UNSPEC, &ch[0].rctxt);
+
+		WAIT_CQ(ch[0].cq, 1);
+	}
+
+	ret = fi_av_insert(av, &partner_addr, 1, &sep_peer_addr, 0, NULL);
+	CHK_ERR("fi_av_insert", (ret!=1), ret);
+
+	/* get the address of all peer channelss */
+	for (i=0; i<opt.num_ch; i++)
+		ch[i].peer_addr = fi_rx_addr(sep_peer_addr, i, 8);
+
+	if (opt.self || !opt.client)
+		return;
+
+	/* send my local addresses to peer channel 0 */
+	bound_addrlen = sizeof(bound_addr);
+	err = fi_getname((fid_t)sep, &bound_addr, &bound_addrlen);
+	CHK_ERR("fi_getname", (err<0), err);
+
+	SEND_MSG(ch[0].tx, &bound_addr, bound_addrlen,
+			ch[0].peer_addr, &ch[0].sctxt);
+
+	WAIT_CQ(ch[0].cq, 1);
+}
+
+static void wait_eq(uint32_t expected, struct fi_eq_cm_entry *entry)
+{
+	struct fi_eq_err_entry	err_entry;
+	uint32_t		event;
+	ssize_t			ret;
+
+	ret = fi_eq_sread(eq, &event, entry, sizeof(*entry), -1, 0);
+	if (ret == -FI_EAVAIL) {
+		fi_eq_readerr(eq, &err_entry, 0);
+		fprintf(stderr, "fi_eq_sread: %s\n", fi_eq_strerror(eq,
+			err_entry.prov_errno, err_entry.err_data, NULL, 0));
+		exit(1);
+	}
+	CHK_ERR("fi_eq_sread", (ret<0), ret);
+
+	if (event != expected) {
+		fprintf(stderr, "fi_eq_sread: event %u, expected %u\n", event, expected);
+		exit(1);
+	}
+}
+
+/*
+ * FI_EP_MSG: the channels are connected one by one, so the server's
+ * i-th connection request comes from the client's channel i. The
+ * client times fi_connect() to FI_CONNECTED, the server the request to
+ * FI_CONNECTED including its endpoint and fi_accept().
+ */
+static void connect_channels(void)
+{
+	struct fi_eq_cm_entry	entry;
+	double			t;
+	int			err;
+	int			i;
+
+	for (i=0; i<opt.num_ch; i++) {
+		if (opt.client) {
+			open_ep(i, fi);
+
+			t = when();
+			err = fi_connect(ch[i].ep, fi->dest_addr, NULL, 0);
+			CHK_ERR("fi_connect", (err<0), err);
+		}
+		else {
+			wait_eq(FI_CONNREQ, &entry);
+
+			t = when();
+			open_ep(i, entry.info);
+			fi_freeinfo(entry.info);
+
+			err = fi_accept(ch[i].ep, NULL, 0);
+			CHK_ERR("fi_accept", (err<0), err);
+		}
+
+		wait_eq(FI_CONNECTED, &entry);
+		printf("connect [%d]: %8.2lf us\n", i, when() - t);
+	}
+}
+
+static void get_peer_address(void)
+{
+	struct { char raw[16]; }	bound_addr, partner_addr;
+	size_t				bound_addrlen;
+	int				err;
+	int				ret;
+	int				i;
+
+	if (opt.ranks) {
+		get_rank_addresses();
+		return;
+	}
+
+	/* connected endpoints take no address */
+	if (opt.ep_type == FI_EP_MSG) {
+		connect_channels();
+		return;
+	}
+
+	if (opt.layout == LAYOUT_SEP) {
+		get_sep_peer_address();
+		return;
+	}
+
+	if (opt.self) {
+		/* every channel targets itself */
+		for (i=0; i<opt.num_ch; i++) {
+			bound_addrlen = sizeof(bound_addr);
+			err = fi_getname((fid_t)ch[i].ep, &bound_addr, &bound_addrlen);
+			CHK_ERR("fi_getname", (err<0), err);
+
+			ret = fi_av_insert(av, &bound_addr, 1, &ch[i].peer_addr, 0, NULL);
+			CHK_ERR("fi_av_insert", (ret!=1), ret);
+		}
+		return;
+	}
+
+	if (opt.client) {
+		/* get the address of peer channel 0 */
+		if (!fi->dest_addr) {
+			fprintf(stderr, "couldn't get server address\n");
+			exit(1);
+		}
+		memcpy(&partner_addr, fi->dest_addr, fi->dest_addrlen);
+
+		ret = fi_av_insert(av, &partner_addr, 1, &ch[0].peer_addr, 0, NULL);
+		CHK_ERR("fi_av_insert", (ret!=1), ret);
+
+		/* send all my local addresses to peer channel 0 */
+		for (i=0; i<opt.num_ch; i++) {
+			bound_addrlen = sizeof(bound_addr);
+			err = fi_getname((fid_t)ch[i].ep, &bound_addr, &bound_addrlen);
+			CHK_ERR("fi_getname", (err<0), err);
+
+			SEND_MSG(ch[0].tx, &bound_addr, bound_addrlen,
+					ch[0].peer_addr, &ch[0].sctxt);
+
+			WAIT_CQ(ch[0].cq, 1);
+		}
+
+		/*
+		 * receive peer addresses except channel 0, all on channel 0:
+		 * with -l shared the channels share one receive context, so a
+		 * receive posted on channel i could take any of them
+		 */
+		for (i=1; i<opt.num_ch; i++) {
+			RECV_MSG(ch[0].rx, &partner_addr, sizeof(partner_addr),
+				 FI_ADDR_UNSPEC, &ch[0].rctxt);
+
+			WAIT_CQ(ch[0].cq, 1);
+
+			ret = fi_av_insert(av, &partner_addr, 1, &ch[i].peer_addr, 0, NULL);
+			CHK_ERR("fi_av_insert", (ret!=1), ret);
+		}
+	} else {
+		/* receive all peer addresses from channel 0 */
+		for (i=0; i<opt.num_ch; i++) {
+			RECV_MSG(ch[0].rx, &partner_addr, sizeof(partner_addr),
+				 FI_ADDR_UNSPEC, &ch[0].rctxt);
+
+			WAIT_CQ(ch[0].cq, 1);
+
+			ret = fi_av_insert(av, &partner_addr, 1, &ch[i].peer_addr, 0, NULL);
+			CHK_ERR("fi_av_insert", (ret!=1), ret);
+		}
+
+		/* send all my local addresses (except channle 0) to peer channel 0 */
+		for (i=1; i<opt.num_ch; i++) {
+			bound_addrlen = sizeof(bound_addr);
+			err = fi_getname((fid_t)ch[i].ep, &bound_addr, &bound_addrlen);
+			CHK_ERR("fi_getname", (err<0), err);
+
+			SEND_MSG(ch[0].tx, &bound_addr, bound_addrlen,
+					ch[0].peer_addr, &ch[0].sctxt);
+
+			WAIT_CQ(ch[0].cq, 1);
+		}
+	}
+}
+
+/****************************
+ *	Payload Verification
+ ****************************/
+
+/*
+ * -v: the sender fills the payload with words seed + k * VERIFY_STEP,
+ * the seed made from the size and the number of messages or writes so
+ * far on the channel in that direction, and the receiver checks them on
+ * completion. Both sides count the same operations because paired
+ * points run the same iterations. Only the generic loops are run and
+ * the time spent filling and checking is reported per point.
+ */
+
+#define VERIFY_STEP	    0x9E3779B97F4A7C15ULL
+#define VERIFY_MAX_PRINT    10
+
+static struct {
+	uint64_t	tx;		/* messages/writes sent */
+	uint64_t	rx;		/* and received */
+	double		time;		/* us spent filling and checking */
+	long		errors;
+} vstate[MAX_NUM_CHANNELS];
+
+static struct {
+	uint64_t	tx;		/* sums over the channels at the last report */
+	uint64_t	rx;
+	double		time;
+	long		errors;
+	int		printed;
+} vreport;
+
+static void fill_generic(uint64_t *p, size_t n, uint64_t seed)
+{
+	size_t k;
+
+	for (k=0; k<n; k++)
+		p[k] = seed + k * VERIFY_STEP;
+}
+
+/* index of the first word that differs, n if none */
+static size_t check_generic(const uint64_t *p, size_t n, uint64_t seed)
+{
+	size_t k;
+
+	for (k=0; k<n; k++)
+		if (p[k] != seed + k * VERIFY_STEP)
+			return k;
+	return n;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static void fill_avx2(uint64_t *p, size_t n, uint64_t seed)
+{
+	__m256i v = _mm256_set_epi64x(seed + 3 * VERIFY_STEP, seed + 2 * VERIFY_STEP,
+				      seed + VERIFY_STEP, seed);
+	__m256i inc = _mm256_set1_epi64x(4 * VERIFY_STEP);
+	size_t k;
+
+	for (k=0; k + 4 <= n; k += 4) {
+		_mm256_storeu_si256((__m256i *)(p + k), v);
+		v = _mm256_add_epi64(v, inc);
+	}
+	fill_generic(p + k, n - k, seed + k * VERIFY_STEP);
+}
+
+__attribute__((target("avx2")))
+static size_t check_avx2(const uint64_t *p, size_t n, uint64_t seed)
+{
+	__m256i v = _mm256_set_epi64x(seed + 3 * VERIFY_STEP, seed + 2 * VERIFY_STEP,
+				      seed + VERIFY_STEP, seed);
+	__m256i inc = _mm256_set1_epi64x(4 * VERIFY_STEP);
+	__m256i x;
+	size_t k;
+
+	for (k=0; k + 4 <= n; k += 4) {
+		x = _mm256_loadu_si256((const __m256i *)(p + k));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(x, v)) != -1)
+			break;
+		v = _mm256_add_epi64(v, inc);
+	}
+	return k + check_generic(p + k, n - k, seed + k * VERIFY_STEP);
+}
+
+__attribute__((target("avx512f")))
+static void fill_avx512(uint64_t *p, size_t n, uint64_t seed)
+{
+	__m512i v = _mm512_set_epi64(seed + 7 * VERIFY_STEP, seed + 6 * VERIFY_STEP,
+				     seed + 5 * VERIFY_STEP, seed + 4 * VERIFY_STEP,
+				     seed + 3 * VERIFY_STEP, seed + 2 * VERIFY_STEP,
+				     seed + VERIFY_STEP, seed);
+	__m512i inc = _mm512_set1_epi64(8 * VERIFY_STEP);
+	size_t k;
+
+	for (k=0; k + 8 <= n; k += 8) {
+		_mm512_storeu_si512((void *)(p + k), v);
+		v = _mm512_add_epi64(v, inc);
+	}
+	fill_generic(p + k, n - k, seed + k * VERIFY_STEP);
+}
+
+__attribute__((target("avx512f")))
+static size_t check_avx512(const uint64_t *p, size_t n, uint64_t seed)
+{
+	__m512i v = _mm512_set_epi64(seed + 7 * VERIFY_STEP, seed + 6 * VERIFY_STEP,
+				     seed + 5 * VERIFY_STEP, seed + 4 * VERIFY_STEP,
+				     seed + 3 * VERIFY_STEP, seed + 2 * VERIFY_STEP,
+				     seed + VERIFY_STEP, seed);
+	__m512i inc = _mm512_set1_epi64(8 * VERIFY_STEP);
+	__m512i x;
+	size_t k;
+
+	for (k=0; k + 8 <= n; k += 8) {
+		x = _mm512_loadu_si512((const void *)(p + k));
+		if (_mm512_cmpneq_epi64_mask(x, v))
+			break;
+		v = _mm512_add_epi64(v, inc);
+	}
+	return k + check_generic(p + k, n - k, seed + k * VERIFY_STEP);
+}
+#endif
+
+static void (*fill_words)(uint64_t *p, size_t n, uint64_t seed) = fill_generic;
+static size_t (*check_words)(const uint64_t *p, size_t n, uint64_t seed) = check_generic;
+static const char *verify_kernel = "generic";
+
+/* -G keeps the scalar kernels for comparison */
+static void init_verify_kernel(void)
+{
+	if (opt.generic)
+		return;
+
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		fill_words = fill_avx512;
+		check_words = check_avx512;
+		verify_kernel = "avx512";
+	}
+	else if (__builtin_cpu_supports("avx2")) {
+		fill_words = fill_avx2;
+		check_words = check_avx2;
+		verify_kernel = "avx2";
+	}
+#endif
+}
+
+static inline uint64_t verify_seed(int size, uint64_t n)
+{
+	return ((uint64_t)size << 40) ^ (n * 0xD1B54A32D192ED03ULL);
+}
+
+/* before channel i sends or writes size bytes from sbuf */
+static void verify_fill(int i, int size)
+{
+	uint64_t seed = verify_seed(size, vstate[i].tx++);
+	size_t n = size / 8;
+	uint64_t tail;
+	double t = when();
+
+	fill_words((uint64_t *)ch[i].sbuf, n, seed);
+	tail = seed + n * VERIFY_STEP;
+	memcpy(ch[i].sbuf + n * 8, &tail, size % 8);
+
+	vstate[i].time += when() - t;
+}
+
+/* after size bytes have landed in ch[i].rbuf */
+static void verify_check(int i, int size)
+{
+	uint64_t seed = verify_seed(size, vstate[i].rx++);
+	size_t len = size;
+	size_t n = len / 8;
+	size_t k;
+	uint64_t tail;
+	double t = when();
+
+	k = check_words((const uint64_t *)ch[i].rbuf, n, seed) * 8;
+	if (k == n * 8) {
+		tail = seed + n * VERIFY_STEP;
+		if (memcmp(ch[i].rbuf + k, &tail, len % 8) == 0)
+			k = len;
+	}
+
+	vstate[i].time += when() - t;
+	if (k == len)
+		return;
+
+	vstate[i].errors++;
+	if (vreport.printed++ < VERIFY_MAX_PRINT)
+		fprintf(stderr, "verify: channel %d, size %d, message %" PRIu64
+			": bad data at byte %zu\n", i, size, vstate[i].rx - 1, k);
+}
+
+/* leader: the verification cost since the last report, t is us per iteration */
+static void verify_report(double t)
+{
+	uint64_t tx = 0, rx = 0, iters;
+	double time = 0, cost;
+	long errors = 0;
+	int i;
+
+	for (i=0; i<opt.num_ch; i++) {
+		tx += vstate[i].tx;
+		rx += vstate[i].rx;
+		time += vstate[i].time;
+		errors += vstate[i].errors;
+	}
+
+	/* a fill, a check or both per channel and iteration */
+	iters = (tx - vreport.tx > rx - vreport.rx ? tx - vreport.tx : rx - vreport.rx) / opt.num_ch;
+	if (iters) {
+		cost = (time - vreport.time) / opt.num_ch / iters;
+		printf("verify (%s): %8.3lf us/iter (%5.1lf%%), %ld errors\n", verify_kernel,
+			cost, 100.0 * cost / t, errors - vreport.errors);
+	}
+
+	vreport.tx = tx;
+	vreport.rx = rx;
+	vreport.time = time;
+	vreport.errors = errors;
+}
+
+static long verify_errors(void)
+{
+	long errors = 0;
+	int i;
+
+	for (i=0; i<opt.num_ch; i++)
+		errors += vstate[i].errors;
+	return errors;
+}
+
+/****************************
+ *	MSG Test
+ ****************************/
+
+static void send_one(int size)
+{
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		if (opt.verify)
+			verify_fill(i, size);
+		SEND_MSG(ch[i].tx, ch[i].sbuf, size, ch[i].peer_addr, &ch[i].sctxt);
+	}
+
+	for (i=ch_first; i<ch_last; i++) {
+		WAIT_CQ(ch[i].cq, 1);
+		STAMP(i);
+	}
+}
+
+static void recv_one(int size)
+{
+	int i;
+
+	for (i=ch_first; i<ch_last; i++)
+		RECV_MSG(ch[i].rx, ch[i].rbuf, size, ch[i].peer_addr, &ch[i].rctxt);
+
+	for (i=ch_first; i<ch_last; i++) {
+		WAIT_CQ(ch[i].cq, 1);
+		STAMP(i);
+		if (opt.verify)
+			verify_check(i, size);
+	}
+}
+
+/* SYMMETRIC: every channel sends and receives at once */
+static void sendrecv_one(int size)
+{
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		RECV_MSG(ch[i].rx, ch[i].rbuf, size, ch[i].peer_addr, &ch[i].rctxt);
+		if (opt.verify)
+			verify_fill(i, size);
+		SEND_MSG(ch[i].tx, ch[i].sbuf, size, ch[i].peer_addr, &ch[i].sctxt);
+	}
+
+	for (i=ch_first; i<ch_last; i++) {
+		WAIT_CQ(ch[i].cq, 2);
+		STAMP(i);
+		if (opt.verify)
+			verify_check(i, size);
+	}
+}
+
+static void msg_iter(int size, int arg)
+{
+	if (SYMMETRIC) {
+		sendrecv_one(size);
+	}
+	else if (opt.client) {
+		recv_one(size);
+		send_one(size);
+	}
+	else {
+		send_one(size);
+		recv_one(size);
+	}
+}
+
+static void run_msg_test(void)
+{
+	int size;
+	int k, repeat;
+	double t, *ts = NULL;
+
+	if (opt.detect) {
+		ts = malloc(sweep.num_sizes * sizeof(*ts));
+		CHK_ERR("malloc", (!ts), -ENOMEM);
+	}
+
+	for (k=0; k<sweep.num_sizes; k++) {
+		size = sweep.sizes[k];
+		t = run_point(msg_iter, size, 0, size, POINT_PAIRED, &repeat) / 2;
+		if (ts)
+			ts[k] = t;
+		if (!LEADER)
+			continue;
+
+		printf("send/recv %-8d (x %4d): %8.2lf us, %8.2lf MB/s\n",
+			size, repeat, t, size/t);
+		if (opt.ranks)
+			report_pairs(2);
+		if (opt.verify)
+			verify_report(t * 2);
+		phase_report();
+		record_point(opt.tag ? "tagged" : "msg", 0, size, repeat, t, 2);
+	}
+
+	if (ts) {
+		find_switches(opt.tag ? "tagged" : "msg", msg_iter, 2,
+			      sweep.num_sizes, sweep.sizes, ts);
+		free(ts);
+	}
+}
+
+/****************************
+ *	Datagram Test
+ ****************************/
+
+/*
+ * -e dgram: the client streams numbered datagrams to the server, which
+ * counts what arrives in a ring of posted receives. Every point is
+ * bracketed by a START and a FIN request that the client repeats until
+ * the server answers, the FIN reply carrying the server's counts. Only
+ * the address exchange at startup is a single datagram.
+ */
+
+#define DGRAM_RING	    64		/* posted receives / sends in flight */
+#define DGRAM_COUNT	    10000	/* datagrams per point without -n */
+#define DGRAM_TIMEOUT	    100000	/* us before a request is repeated */
+#define DGRAM_RETRIES	    50
+#define DGRAM_LINGER	    1000000	/* us the server answers repeated ENDs */
+
+#define DGRAM_DATA	    0
+#define DGRAM_START	    1
+#define DGRAM_FIN	    2
+#define DGRAM_END	    3
+
+struct dgram_hdr {
+	uint32_t	type;
+	uint32_t	point;
+	uint64_t	seq;		/* DGRAM_DATA only */
+};
+
+struct dgram_report {
+	struct dgram_hdr	hdr;
+	uint64_t		received;
+	uint64_t		reordered;	/* arrived after a higher seq */
+	double			elapsed;	/* first to last datagram, us */
+};
+
+static struct {
+	int	ring;
+	int	mtu;		/* largest size, also the slot size */
+} dgram;
+
+static void dgram_init(void)
+{
+	size_t ring = DGRAM_RING;
+	size_t mtu;
+
+	if (fi->rx_attr->size < ring)
+		ring = fi->rx_attr->size;
+	if (fi->tx_attr->size < ring)
+		ring = fi->tx_attr->size;
+
+	mtu = buf_size / ring;
+	if (fi->ep_attr->max_msg_size < mtu)
+		mtu = fi->ep_attr->max_msg_size;
+
+	dgram.ring = ring;
+	dgram.mtu = mtu;
+}
+
+static void dgram_post(int slot)
+{
+	int ret;
+
+	ret = fi_recv(ch[0].rx, ch[0].rbuf + slot * dgram.mtu, dgram.mtu, NULL,
+		      FI_ADDR_UNSPEC, ctx_of(0, slot));
+	CHK_ERR("fi_recv", (ret<0), ret);
+}
+
+/*
+ * Reply to a request from the context after the ring that belongs to
+ * its type. A reply still in flight is not repeated; the client asks
+ * again.
+ */
+static void dgram_reply(struct dgram_report *rep, int *busy)
+{
+	int c = dgram.ring + rep->hdr.type;
+	int ret;
+
+	if (busy[rep->hdr.type])
+		return;
+
+	ret = fi_send(ch[0].tx, rep, sizeof(*rep), NULL, ch[0].peer_addr,
+		      ctx_of(0, c));
+	if (ret == -FI_EAGAIN)
+		return;
+	CHK_ERR("fi_send", (ret<0), ret);
+	busy[rep->hdr.type] = 1;
+}
+
+static void dgram_serve(void)
+{
+	struct fi_cq_tagged_entry entry;
+	struct dgram_report cur, fin, ack;
+	struct dgram_hdr *h;
+	uint64_t max_seq = 0;
+	double first = 0, last = 0, done_at = 0;
+	int busy[DGRAM_END + 1] = { 0 };
+	uint32_t point = 0;
+	int started = 0, done = 0;
+	int slot, ret;
+
+	memset(&cur, 0, sizeof(cur));
+	memset(&fin, 0, sizeof(fin));
+	memset(&ack, 0, sizeof(ack));
+
+	for (slot=0; slot<dgram.ring; slot++)
+		dgram_post(slot);
+
+	while (!done || when() - done_at < DGRAM_LINGER) {
+		ret = fi_cq_read(ch[0].cq, &entry, 1);
+		if (ret == -FI_EAGAIN)
+			continue;
+		CHK_ERR("fi_cq_read", (ret<0), ret);
+
+		slot = ctx_slot(0, entry.op_context);
+		if (slot >= dgram.ring) {
+			busy[slot - dgram.ring] = 0;
+			continue;
+		}
+
+		h = (struct dgram_hdr *)(ch[0].rbuf + slot * dgram.mtu);
+		switch (h->type) {
+		case DGRAM_DATA:
+			if (h->point != point || !started)
+				break;
+			last = when();
+			if (!cur.received++)
+				first = last;
+			if (h->seq < max_seq)
+				cur.reordered++;
+			else
+				max_seq = h->seq;
+			break;
+
+		case DGRAM_START:
+			if (h->point == point && !started) {
+				memset(&cur, 0, sizeof(cur));
+				max_seq = 0;
+				started = 1;
+			}
+			if (h->point == point) {
+				ack.hdr = *h;
+				dgram_reply(&ack, busy);
+			}
+			break;
+
+		case DGRAM_FIN:
+			if (h->point == point && started) {
+				cur.hdr = *h;
+				cur.elapsed = cur.received ? last - first : 0;
+				fin = cur;
+				started = 0;
+				point++;
+			}
+			if (h->point + 1 == point)
+				dgram_reply(&fin, busy);
+			break;
+
+		case DGRAM_END:
+			if (h->point == point) {
+				if (!done)
+					done_at = when();
+				done = 1;
+				ack.hdr = *h;
+				dgram_reply(&ack, busy);
+			}
+			break;
+		}
+
+		dgram_post(slot);
+	}
+}
+
+/* wait for the send completion of the last request, dropping late replies */
+static void dgram_drain(int *busy)
+{
+	struct fi_cq_tagged_entry entry;
+	int ret;
+
+	while (*busy) {
+		ret = fi_cq_read(ch[0].cq, &entry, 1);
+		if (ret == -FI_EAGAIN)
+			continue;
+		CHK_ERR("fi_cq_read", (ret<0), ret);
+
+		if (entry.op_context == &ch[0].sctxt)
+			*busy = 0;
+		else
+			RECV_MSG(ch[0].rx, ch[0].rbuf, dgram.mtu, FI_ADDR_UNSPEC, &ch[0].rctxt);
+	}
+}
+
+/* send a request until the reply to it arrives, the reply in *rep */
+static void dgram_call(uint32_t type, uint32_t point, struct dgram_report *rep)
+{
+	static struct dgram_hdr req;
+	struct dgram_report *r = (struct dgram_report *)ch[0].rbuf;
+	struct fi_cq_tagged_entry entry;
+	static int busy;
+	double t;
+	int tries, ret;
+
+	req.type = type;
+	req.point = point;
+	req.seq = 0;
+
+	for (tries=0; tries<DGRAM_RETRIES; tries++) {
+		if (!busy) {
+			ret = fi_send(ch[0].tx, &req, sizeof(req), NULL,
+				      ch[0].peer_addr, &ch[0].sctxt);
+			if (ret != -FI_EAGAIN) {
+				CHK_ERR("fi_send", (ret<0), ret);
+				busy = 1;
+			}
+		}
+
+		t = when();
+		while (when() - t < DGRAM_TIMEOUT) {
+			ret = fi_cq_read(ch[0].cq, &entry, 1);
+			if (ret == -FI_EAGAIN)
+				continue;
+			CHK_ERR("fi_cq_read", (ret<0), ret);
+
+			if (entry.op_context == &ch[0].sctxt) {
+				busy = 0;
+				continue;
+			}
+
+			if (r->hdr.type == type && r->hdr.point == point) {
+				if (rep)
+					*rep = *r;
+				RECV_MSG(ch[0].rx, ch[0].rbuf, dgram.mtu, FI_ADDR_UNSPEC, &ch[0].rctxt);
+				dgram_drain(&busy);
+				return;
+			}
+
+			/* a stale reply */
+			RECV_MSG(ch[0].rx, ch[0].rbuf, dgram.mtu, FI_ADDR_UNSPEC, &ch[0].rctxt);
+		}
+	}
+
+	fprintf(stderr, "dgram: no reply from the server\n");
+	exit(1);
+}
+
+/* all datagrams of one point, return the time until the last completed */
+static double dgram_stream(int point, int size, int count)
+{
+	struct fi_cq_tagged_entry entry[DGRAM_RING];
+	struct dgram_hdr *h;
+	int posted = 0, completed = 0;
+	int slot, ret;
+	double t1;
+	int k;
+
+	ctx_reset(0, dgram.ring);
+
+	t1 = when();
+
+	while (completed < count) {
+		while (posted < count && ch[0].nfree) {
+			slot = ctx_get(0);
+			h = (struct dgram_hdr *)(ch[0].sbuf + slot * dgram.mtu);
+			h->type = DGRAM_DATA;
+			h->point = point;
+			h->seq = posted;
+
+			ret = fi_send(ch[0].tx, h, size, NULL, ch[0].peer_addr,
+				      ctx_of(0, slot));
+			if (ret == -FI_EAGAIN) {
+				ctx_put(0, slot);
+				break;
+			}
+			CHK_ERR("fi_send", (ret<0), ret);
+			posted++;
+		}
+
+		ret = fi_cq_read(ch[0].cq, entry, dgram.ring);
+		if (ret == -FI_EAGAIN)
+			continue;
+		CHK_ERR("fi_cq_read", (ret<0), ret);
+
+		for (k=0; k<ret; k++) {
+			if (ctx_owned(0, entry[k].op_context)) {
+				ctx_done(0, entry[k].op_context);
+				completed++;
+			}
+			else if (entry[k].op_context == &ch[0].rctxt) {
+				/* a repeated reply to the START request */
+				RECV_MSG(ch[0].rx, ch[0].rbuf, dgram.mtu, FI_ADDR_UNSPEC,
+					 &ch[0].rctxt);
+			}
+		}
+	}
+
+	return when() - t1;
+}
+
+static void run_dgram_test(void)
+{
+	struct dgram_report rep;
+	int count = sweep.iters ? sweep.iters : DGRAM_COUNT;
+	int point = 0;
+	int size, k;
+	double t;
+
+	dgram_init();
+
+	if (!opt.client) {
+		dgram_serve();
+		return;
+	}
+
+	RECV_MSG(ch[0].rx, ch[0].rbuf, dgram.mtu, FI_ADDR_UNSPEC, &ch[0].rctxt);
+
+	for (k=0; k<sweep.num_sizes; k++) {
+		size = sweep.sizes[k];
+		if (size < (int)sizeof(struct dgram_hdr) || size > dgram.mtu) {
+			printf("dgram %-8d: skipped, sizes are %zu to %d\n",
+				size, sizeof(struct dgram_hdr), dgram.mtu);
+			continue;
+		}
+
+		dgram_call(DGRAM_START, point, NULL);
+		t = dgram_stream(point, size, count);
+		dgram_call(DGRAM_FIN, point, &rep);
+		point++;
+
+		printf("dgram %-8d (x %6d): sent %9.0lf pkt/s, received %9.0lf pkt/s (%8.2lf MB/s), "
+			"loss %6.2lf%%, reordered %6.2lf%%\n",
+			size, count, count / t * 1e6,
+			rep.elapsed ? rep.received / rep.elapsed * 1e6 : 0,
+			rep.elapsed ? rep.received * size / rep.elapsed : 0,
+			100.0 * (count - (long)rep.received) / count,
+			rep.received ? 100.0 * rep.reordered / rep.received : 0);
+		if (rep.received)
+			record_point("dgram", 0, size, rep.received,
+				     rep.elapsed / rep.received, 1);
+	}
+
+	dgram_call(DGRAM_END, point, NULL);
+}
+
+/****************************
+ *	RMA Test
+ ****************************/
+
+/*
+ * Before API 1.5 mr_mode is FI_MR_BASIC or FI_MR_SCALABLE, after it a
+ * set of bits where the absence of FI_MR_VIRT_ADDR and FI_MR_PROV_KEY
+ * is the old scalable mode.
+ */
+static int mr_virt_addr(void)
+{
+#if HDR_VERSION >= FI_VERSION(1, 5)
+	if (api_version() >= FI_VERSION(1, 5))
+		return !!(fi->domain_attr->mr_mode & FI_MR_VIRT_ADDR);
+#endif
+	return fi->domain_attr->mr_mode != FI_MR_SCALABLE;
+}
+
+/* keys are the requested ones and addresses are offsets */
+static int mr_scalable(void)
+{
+#if HDR_VERSION >= FI_VERSION(1, 5)
+	if (api_version() >= FI_VERSION(1, 5))
+		return !(fi->domain_attr->mr_mode & (FI_MR_VIRT_ADDR | FI_MR_PROV_KEY));
+#endif
+	return fi->domain_attr->mr_mode == FI_MR_SCALABLE;
+}
+
+static void exchange_rma_info(void)
+{
+	struct rma_info my_rma_info;
+	int i, j;
+
+	if (mr_scalable()) {
+		for (i=ch_first; i<ch_last; i++) {
+			/* the keys follow the index of the peer's channel */
+			j = opt.ranks ? peer_chan(peer_rank(opt.rank, i), opt.rank) : i;
+			ch[i].peer_rma_info.sbuf_addr = 0ULL;
+			ch[i].peer_rma_info.sbuf_key = (uint64_t)(j+j+1);
+			ch[i].peer_rma_info.rbuf_addr = 0ULL;
+			ch[i].peer_rma_info.rbuf_key = (uint64_t)(j+j+2);
+		}
+		return;
+	}
+
+	for (i=ch_first; i<ch_last; i++) {
+		my_rma_info.sbuf_addr = mr_virt_addr() ? (uint64_t)ch[i].sbuf : 0ULL;
+		my_rma_info.sbuf_key = fi_mr_key(ch[i].smr);
+		my_rma_info.rbuf_addr = mr_virt_addr() ? (uint64_t)ch[i].rbuf : 0ULL;
+		my_rma_info.rbuf_key = fi_mr_key(ch[i].rmr);
+
+		printf("my rma info: saddr=%llx skey=%llx raddr=%llx rkey=%llx\n",
+			my_rma_info.sbuf_addr, my_rma_info.sbuf_key,
+			my_rma_info.rbuf_addr, my_rma_info.rbuf_key);
+
+		SEND_MSG(ch[i].tx, &my_rma_info, sizeof(my_rma_info),
+				ch[i].peer_addr, &ch[i].sctxt);
+
+		RECV_MSG(ch[i].rx, &ch[i].peer_rma_info, sizeof(ch[i].peer_rma_info),
+				ch[i].peer_addr, &ch[i].rctxt);
+
+		WAIT_CQ(ch[i].cq, 2);
+
+		printf("peer rma info [%d]: saddr=%llx skey=%llx raddr=%llx rkey=%llx\n", i,
+			ch[i].peer_rma_info.sbuf_addr, ch[i].peer_rma_info.sbuf_key,
+			ch[i].peer_rma_info.rbuf_addr, ch[i].peer_rma_info.rbuf_key);
+	}
+}
+
+/* wait for n completions on ch[i].cq while driving the other channels */
+static void wait_cq_progress(int i, int n)
+{
+	struct fi_cq_tagged_entry entry[n];
+	int ret, completed = 0;
+	int k;
+
+	while (completed < n) {
+		for (k=ch_first; k<ch_last; k++) {
+			if (k != i) {
+				PHASE(PH_CQ, fi_cq_read(ch[k].cq, NULL, 0));
+				continue;
+			}
+			ret = PHASE(PH_CQ, fi_cq_read(ch[i].cq, entry, n - completed));
+			if (ret == -FI_EAGAIN)
+				continue;
+			CHK_ERR("fi_cq_read", (ret<0), ret);
+			completed += ret;
+		}
+	}
+}
+
+static void synchronize(void)
+{
+	int dummy, dummy2;
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		SEND_MSG(ch[i].tx, &dummy, sizeof(dummy), ch[i].peer_addr, &ch[i].sctxt);
+		RECV_MSG(ch[i].rx, &dummy2, sizeof(dummy2), ch[i].peer_addr, &ch[i].rctxt);
+
+		/* contexts of a scalable endpoint may need progress on each other */
+		if (opt.layout == LAYOUT_SEP)
+			wait_cq_progress(i, 2);
+		else
+			WAIT_CQ(ch[i].cq, 2);
+	}
+
+	barrier();
+	if (LEADER)
+		printf("====================== sync =======================\n");
+}
+
+static void write_one(int size)
+{
+	int ret;
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		if (opt.verify)
+			verify_fill(i, size);
+		ret = PHASE(PH_RMA,
+			    fi_write(ch[i].tx, ch[i].sbuf, size, NULL, ch[i].peer_addr,
+				     ch[i].peer_rma_info.rbuf_addr,
+				     ch[i].peer_rma_info.rbuf_key,
+				     &ch[i].sctxt));
+		CHK_ERR("fi_write", (ret<0), ret);
+
+		WAIT_CQ(ch[i].cq, 1);
+		STAMP(i);
+	}
+}
+
+static void read_one(int size)
+{
+	int ret;
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		ret = PHASE(PH_RMA,
+			    fi_read(ch[i].tx, ch[i].rbuf, size, NULL, ch[i].peer_addr,
+				    ch[i].peer_rma_info.sbuf_addr,
+				    ch[i].peer_rma_info.sbuf_key,
+				    &ch[i].rctxt));
+		CHK_ERR("fi_readfrom", (ret<0), ret);
+
+		WAIT_CQ(ch[i].cq, 1);
+		STAMP(i);
+	}
+}
+
+static inline void poll_one(int size)
+{
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		volatile char *p = ch[i].rbuf + size - 1;
+		while (*p != ('a'+i))
+			PHASE(PH_CQ, fi_cq_read(ch[i].cq, NULL, 0));
+	}
+}
+
+static inline void reset_one(int size)
+{
+	int i;
+
+	for (i=ch_first; i<ch_last; i++)
+		ch[i].rbuf[size-1] = 'o' + i;
+}
+
+static inline wait_one(void)
+{
+	static uint64_t completed[MAX_NUM_CHANNELS];
+	uint64_t counter;
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		while (1) {
+			counter = PHASE_CNTR(fi_cntr_read(ch[i].cntr), completed[i]);
+			if (counter > completed[i])
+				break;
+		}
+		completed[i]++;
+		STAMP(i);
+	}
+}
+
+/*
+ * -v: the peer's write has landed in rbuf. It cannot have written again
+ * yet, since with -b it waits for this side's write before the next one.
+ */
+static inline void check_one(int size)
+{
+	int i;
+
+	if (opt.verify)
+		for (i=ch_first; i<ch_last; i++)
+			verify_check(i, size);
+}
+
+static void write_iter(int size, int arg)
+{
+	if (opt.client) {
+		write_one(size);
+		//poll_one(size);
+		//reset_one(size);
+		if (opt.bidir) {
+			wait_one();
+			check_one(size);
+		}
+	}
+	else {
+		wait_one();
+		check_one(size);
+		 if (opt.bidir) {
+			//poll_one(size);
+			//reset_one(size);
+			write_one(size);
+		}
+	}
+}
+
+static void read_iter(int size, int arg)
+{
+	//reset_one(size);
+	read_one(size);
+	//poll_one(size);
+}
+
+/*
+ * Specialized loops: each runs n iterations of one (op, tagged, direction)
+ * combination with the choices msg_iter()/write_iter() make per iteration
+ * fixed at compile time, and without the call through iter_fn_t. They are
+ * picked once per point by select_loop() for the iterations that are not
+ * timed one by one; -G keeps the generic loops for comparison.
+ */
+#define SEND_OP(i, size)								\
+	PHASE(PH_SEND, fi_send(ch[i].tx, ch[i].sbuf, size, NULL, ch[i].peer_addr,	\
+			       &ch[i].sctxt))
+
+#define TSEND_OP(i, size)								\
+	PHASE(PH_SEND, fi_tsend(ch[i].tx, ch[i].sbuf, size, NULL, ch[i].peer_addr,	\
+				MSG_TAG, &ch[i].sctxt))
+
+#define RECV_OP(i, size)								\
+	PHASE(PH_RECV, fi_recv(ch[i].rx, ch[i].rbuf, size, NULL, ch[i].peer_addr,	\
+			       &ch[i].rctxt))
+
+#define TRECV_OP(i, size)								\
+	PHASE(PH_RECV, fi_trecv(ch[i].rx, ch[i].rbuf, size, NULL, ch[i].peer_addr,	\
+				MSG_TAG, 0x0ULL, &ch[i].rctxt))
+
+#define WRITE_OP(i, size)								\
+	PHASE(PH_RMA, fi_write(ch[i].tx, ch[i].sbuf, size, NULL, ch[i].peer_addr,	\
+			       ch[i].peer_rma_info.rbuf_addr,				\
+			       ch[i].peer_rma_info.rbuf_key, &ch[i].sctxt))
+
+#define READ_OP(i, size)								\
+	PHASE(PH_RMA, fi_read(ch[i].tx, ch[i].rbuf, size, NULL, ch[i].peer_addr,	\
+			      ch[i].peer_rma_info.sbuf_addr,				\
+			      ch[i].peer_rma_info.sbuf_key, &ch[i].rctxt))
+
+/* post op on every channel, then wait for all of them */
+#define LOOP_STEP(op, size)								\
+	do {										\
+		int ret, i;								\
+		for (i=ch_first; i<ch_last; i++) {					\
+			ret = op(i, size);						\
+			CHK_ERR(#op, (ret<0), ret);					\
+		}									\
+		for (i=ch_first; i<ch_last; i++)					\
+			WAIT_CQ(ch[i].cq, 1);						\
+	} while (0)
+
+#define DEFINE_LOOP(name, first, second)						\
+	static void name(int size, int n)						\
+	{										\
+		int k;									\
+		for (k=0; k<n; k++) {							\
+			first;								\
+			second;								\
+		}									\
+	}
+
+DEFINE_LOOP(msg_client_loop,  LOOP_STEP(RECV_OP, size),  LOOP_STEP(SEND_OP, size))
+DEFINE_LOOP(msg_server_loop,  LOOP_STEP(SEND_OP, size),  LOOP_STEP(RECV_OP, size))
+DEFINE_LOOP(tmsg_client_loop, LOOP_STEP(TRECV_OP, size), LOOP_STEP(TSEND_OP, size))
+DEFINE_LOOP(tmsg_server_loop, LOOP_STEP(TSEND_OP, size), LOOP_STEP(TRECV_OP, size))
+DEFINE_LOOP(write_client_loop,       LOOP_STEP(WRITE_OP, size), )
+DEFINE_LOOP(write_bidir_client_loop, LOOP_STEP(WRITE_OP, size), wait_one())
+DEFINE_LOOP(write_server_loop,       wait_one(), )
+DEFINE_LOOP(write_bidir_server_loop, wait_one(), LOOP_STEP(WRITE_OP, size))
+DEFINE_LOOP(read_loop,               LOOP_STEP(READ_OP, size), )
+
+static loop_fn_t select_loop(iter_fn_t fn)
+{
+	if (opt.generic || opt.verify || SYMMETRIC)
+		return NULL;
+
+	if (fn == msg_iter) {
+		if (opt.tag)
+			return opt.client ? tmsg_client_loop : tmsg_server_loop;
+		return opt.client ? msg_client_loop : msg_server_loop;
+	}
+
+	if (fn == write_iter) {
+		if (opt.client)
+			return opt.bidir ? write_bidir_client_loop : write_client_loop;
+		return opt.bidir ? write_bidir_server_loop : write_server_loop;
+	}
+
+	if (fn == read_iter)
+		return read_loop;
+
+	return NULL;
+}
+
+static void run_rma_test(void)
+{
+	int size;
+	double t, *ts = NULL;
+	int repeat, k;
+
+	exchange_rma_info();
+
+	if (opt.detect) {
+		ts = malloc(sweep.num_sizes * sizeof(*ts));
+		CHK_ERR("malloc", (!ts), -ENOMEM);
+	}
+
+	synchronize();
+
+	for (k=0; k<sweep.num_sizes; k++) {
+		size = sweep.sizes[k];
+		t = run_point(write_iter, size, 0, size, POINT_PAIRED, &repeat);
+		if (ts)
+			ts[k] = t;
+		if (!LEADER)
+			continue;
+
+		printf("write %-8d (x %4d): %8.2lf us, %8.2lf MB/s\n",
+			size, repeat, t, size/t);
+		if (opt.ranks)
+			report_pairs(1);
+		if (opt.verify)
+			verify_report(t);
+		phase_report();
+		record_point("write", 0, size, repeat, t, 1);
+	}
+
+	if (ts) {
+		find_switches("write", write_iter, 1, sweep.num_sizes, sweep.sizes, ts);
+		free(ts);
+	}
+
+	synchronize();
+
+	if (opt.client || opt.bidir) {
+		for (k=0; k<sweep.num_sizes; k++) {
+			size = sweep.sizes[k];
+			t = run_point(read_iter, size, 0, size, POINT_LOCAL, &repeat);
+			if (!LEADER)
+				continue;
+
+			printf("read  %-8d (x %4d): %8.2lf us, %8.2lf MB/s\n",
+				size, repeat, t, size/t);
+			if (opt.ranks)
+				report_pairs(1);
+			phase_report();
+			record_point("read", 0, size, repeat, t, 1);
+		}
+	}
+	
+	synchronize();
+}
+
+/****************************
+ *	Atomic Test
+ ****************************/
+
+static void atomic_one(int type, int op, int count)
+{
+	int ret;
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		ret = fi_atomic(ch[i].tx, ch[i].sbuf, count, NULL,
+				ch[i].peer_addr,
+				ch[i].peer_rma_info.rbuf_addr,
+				ch[i].peer_rma_info.rbuf_key, 
+				type, op, &ch[i].sctxt);
+		CHK_ERR("fi_atomic", (ret<0), ret);
+
+		WAIT_CQ(ch[i].cq, 1);
+		STAMP(i);
+	}
+}
+
+static void fetch_atomic_one(int type, int op, int count)
+{
+	int ret;
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		ret = fi_fetch_atomic(ch[i].tx, ch[i].sbuf, count, NULL,
+				ch[i].rbuf, NULL,
+				ch[i].peer_addr,
+				ch[i].peer_rma_info.rbuf_addr,
+				ch[i].peer_rma_info.rbuf_key, 
+				type, op, &ch[i].rctxt);
+		CHK_ERR("fi_fetch_atomic", (ret<0), ret);
+
+		WAIT_CQ(ch[i].cq, 1);
+		STAMP(i);
+	}
+}
+
+#define ATOMIC_BASIC	    0
+#define ATOMIC_FETCH	    1
+#define ATOMIC_COMPARE	    2
+#define ATOMIC_NUM_KINDS    3
+
+static const char *atomic_kind_name[ATOMIC_NUM_KINDS] = {
+	"atomic", "fetch", "compare"
+};
+
+static struct {
+	const char	*name;
+	size_t		size;
+} atomic_type[FI_DATATYPE_LAST] = {
+	[FI_INT8]		 = { "int8",	1 },
+	[FI_UINT8]		 = { "uint8",	1 },
+	[FI_INT16]		 = { "int16",	2 },
+	[FI_UINT16]		 = { "uint16",	2 },
+	[FI_INT32]		 = { "int32",	4 },
+	[FI_UINT32]		 = { "uint32",	4 },
+	[FI_INT64]		 = { "int64",	8 },
+	[FI_UINT64]		 = { "uint64",	8 },
+	[FI_FLOAT]		 = { "float",	sizeof(float) },
+	[FI_DOUBLE]		 = { "double",	sizeof(double) },
+	[FI_FLOAT_COMPLEX]	 = { "fcplx",	2 * sizeof(float) },
+	[FI_DOUBLE_COMPLEX]	 = { "dcplx",	2 * sizeof(double) },
+	[FI_LONG_DOUBLE]	 = { "ldbl",	sizeof(long double) },
+	[FI_LONG_DOUBLE_COMPLEX] = { "ldcplx",	2 * sizeof(long double) },
+};
+
+static const char *atomic_op_name[FI_ATOMIC_OP_LAST] = {
+	[FI_MIN]	= "min",
+	[FI_MAX]	= "max",
+	[FI_SUM]	= "sum",
+	[FI_PROD]	= "prod",
+	[FI_LOR]	= "lor",
+	[FI_LAND]	= "land",
+	[FI_BOR]	= "bor",
+	[FI_BAND]	= "band",
+	[FI_LXOR]	= "lxor",
+	[FI_BXOR]	= "bxor",
+	[FI_ATOMIC_READ] = "read",
+	[FI_ATOMIC_WRITE] = "write",
+	[FI_CSWAP]	= "cswap",
+	[FI_CSWAP_NE]	= "cswap_ne",
+	[FI_CSWAP_LE]	= "cswap_le",
+	[FI_CSWAP_LT]	= "cswap_lt",
+	[FI_CSWAP_GE]	= "cswap_ge",
+	[FI_CSWAP_GT]	= "cswap_gt",
+	[FI_MSWAP]	= "mswap",
+};
+
+static int atomic_valid(int kind, int type, int op, size_t *count)
+{
+	switch (kind) {
+	case ATOMIC_BASIC:
+		return !fi_atomicvalid(ch[ch_first].tx, type, op, count);
+	case ATOMIC_FETCH:
+		return !fi_fetch_atomicvalid(ch[ch_first].tx, type, op, count);
+	case ATOMIC_COMPARE:
+		return !fi_compare_atomicvalid(ch[ch_first].tx, type, op, count);
+	}
+	return 0;
+}
+
+/*
+ * The target is the start of the peer's rbuf. The second half of the
+ * local buffers holds the compare operands (sbuf) and the fetched
+ * results (rbuf), so they never overlap a region the peer targets.
+ */
+static void atomic_matrix_one(int kind, int type, int op, size_t count)
+{
+	char *compare, *fetched;
+	int ret;
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		compare = ch[i].sbuf + MAX_MSG_SIZE / 2;
+		fetched = ch[i].rbuf + MAX_MSG_SIZE / 2;
+
+		switch (kind) {
+		case ATOMIC_BASIC:
+			ret = fi_atomic(ch[i].tx, ch[i].sbuf, count, NULL,
+					ch[i].peer_addr,
+					ch[i].peer_rma_info.rbuf_addr,
+					ch[i].peer_rma_info.rbuf_key,
+					type, op, &ch[i].sctxt);
+			CHK_ERR("fi_atomic", (ret<0), ret);
+			break;
+
+		case ATOMIC_FETCH:
+			ret = fi_fetch_atomic(ch[i].tx, ch[i].sbuf, count, NULL,
+					fetched, NULL,
+					ch[i].peer_addr,
+					ch[i].peer_rma_info.rbuf_addr,
+					ch[i].peer_rma_info.rbuf_key,
+					type, op, &ch[i].sctxt);
+			CHK_ERR("fi_fetch_atomic", (ret<0), ret);
+			break;
+
+		case ATOMIC_COMPARE:
+			ret = fi_compare_atomic(ch[i].tx, ch[i].sbuf, count, NULL,
+					compare, NULL, fetched, NULL,
+					ch[i].peer_addr,
+					ch[i].peer_rma_info.rbuf_addr,
+					ch[i].peer_rma_info.rbuf_key,
+					type, op, &ch[i].sctxt);
+			CHK_ERR("fi_compare_atomic", (ret<0), ret);
+			break;
+		}
+
+		WAIT_CQ(ch[i].cq, 1);
+		STAMP(i);
+	}
+}
+
+static struct {
+	int	kind;
+	int	type;
+	int	op;
+} matrix_cur;
+
+static void atomic_matrix_iter(int count, int arg)
+{
+	atomic_matrix_one(matrix_cur.kind, matrix_cur.type, matrix_cur.op, count);
+}
+
+static double atomic_matrix_time(int kind, int type, int op, size_t count)
+{
+	char name[64];
+	double t;
+	int repeat;
+
+	matrix_cur.kind = kind;
+	matrix_cur.type = type;
+	matrix_cur.op = op;
+
+	t = run_point(atomic_matrix_iter, count, 0, count * atomic_type[type].size,
+		      POINT_LOCAL, &repeat);
+
+	snprintf(name, sizeof(name), "%s_%s_%s", atomic_kind_name[kind],
+		 atomic_op_name[op], atomic_type[type].name);
+	record_point(name, count, count * atomic_type[type].size, repeat, t, 1);
+	return t;
+}
+
+/* one cell per (op, datatype), one letter per valid call */
+static void print_atomic_grid(void)
+{
+	size_t count;
+	int type, op, kind;
+	char cell[ATOMIC_NUM_KINDS + 1];
+
+	printf("%-9s", "op\\type");
+	for (type = 0; type < FI_DATATYPE_LAST; type++)
+		printf(" %-6s", atomic_type[type].name);
+	printf("\n");
+
+	for (op = 0; op < FI_ATOMIC_OP_LAST; op++) {
+		printf("%-9s", atomic_op_name[op]);
+		for (type = 0; type < FI_DATATYPE_LAST; type++) {
+			for (kind = 0; kind < ATOMIC_NUM_KINDS; kind++)
+				cell[kind] = atomic_valid(kind, type, op, &count) ?
+						"afc"[kind] : '-';
+			cell[kind] = '\0';
+			printf(" %-6s", cell);
+		}
+		printf("\n");
+	}
+	printf("(a = fi_atomic, f = fi_fetch_atomic, c = fi_compare_atomic)\n");
+}
+
+/*
+ * Query every (datatype, op) combination with fi_atomicvalid(),
+ * fi_fetch_atomicvalid() and fi_compare_atomicvalid(), print the
+ * capability grid, then time each valid combination: latency with a
+ * single element and throughput with the largest count the provider
+ * accepts. Only the initiating side times; the target side stays in
+ * synchronize() to drive progress.
+ */
+static void run_atomic_matrix(void)
+{
+	size_t max_count;
+	int type, op, kind;
+	double lat, t;
+
+	if (LEADER)
+		print_atomic_grid();
+
+	synchronize();
+
+	if (opt.client || opt.bidir) {
+		if (LEADER)
+			printf("%-8s %-7s %-7s %9s %10s %10s\n", "op", "type", "kind",
+				"max_count", "lat(us)", "MB/s");
+
+		for (op = 0; op < FI_ATOMIC_OP_LAST; op++) {
+			for (type = 0; type < FI_DATATYPE_LAST; type++) {
+				for (kind = 0; kind < ATOMIC_NUM_KINDS; kind++) {
+					if (!atomic_valid(kind, type, op, &max_count))
+						continue;
+
+					if (max_count * atomic_type[type].size > MAX_MSG_SIZE / 2)
+						max_count = MAX_MSG_SIZE / 2 / atomic_type[type].size;
+
+					lat = atomic_matrix_time(kind, type, op, 1);
+					t = atomic_matrix_time(kind, type, op, max_count);
+					if (!LEADER)
+						continue;
+
+					printf("%-8s %-7s %-7s %9zu %10.2lf %10.2lf\n",
+						atomic_op_name[op], atomic_type[type].name,
+						atomic_kind_name[kind], max_count, lat,
+						max_count * atomic_type[type].size * opt.num_ch / t);
+				}
+			}
+		}
+	}
+
+	synchronize();
+}
+
+/*
+ * All channels target the first 8 bytes of the peer's channel 0 rbuf.
+ * The operand and compare values are kept in the local sbuf and the
+ * fetched value in the upper half of the local rbuf.
+ */
+#define CONTEND_SRC(i)	((uint64_t *)ch[i].sbuf)
+#define CONTEND_CMP(i)	((uint64_t *)(ch[i].sbuf + sizeof(uint64_t)))
+#define CONTEND_RES(i)	((uint64_t *)(ch[i].rbuf + MAX_MSG_SIZE / 2))
+
+static void print_dist(const char *label, double *v, long n)
+{
+	if (!n)
+		return;
+
+	qsort(v, n, sizeof(*v), cmp_double);
+	printf("\t%-24s min %8.2lf p50 %8.2lf p90 %8.2lf p99 %8.2lf max %8.2lf us\n",
+		label, v[0], v[n/2], v[n*9/10], v[n*99/100], v[n-1]);
+}
+
+static uint64_t contended_read(int i)
+{
+	int ret;
+
+	ret = fi_fetch_atomic(ch[i].tx, CONTEND_SRC(i), 1, NULL,
+			CONTEND_RES(i), NULL,
+			ch[i].peer_addr,
+			ch[0].peer_rma_info.rbuf_addr,
+			ch[0].peer_rma_info.rbuf_key,
+			FI_UINT64, FI_ATOMIC_READ, &ch[i].rctxt);
+	CHK_ERR("fi_fetch_atomic", (ret<0), ret);
+
+	WAIT_CQ(ch[i].cq, 1);
+
+	return *CONTEND_RES(i);
+}
+
+static struct {
+	double		*lat;			/* k * repeat attempt latencies */
+	double		*acq;			/* up to repeat acquire latencies per channel */
+	long		succ[MAX_NUM_CHANNELS];	/* acquisitions per channel */
+	uint64_t	base;
+} contend;
+
+/* one completion on each of channels first to last - 1, at[i] when it came */
+static void contend_reap(int first, int last, double *at)
+{
+	struct fi_cq_tagged_entry entry;
+	int done[MAX_NUM_CHANNELS];
+	int pending = last > first ? last - first : 0;
+	int ret, i;
+
+	for (i=first; i<last; i++)
+		done[i] = 0;
+
+	/* poll them all, so each time ends at its own completion */
+	while (pending) {
+		for (i=first; i<last; i++) {
+			if (done[i])
+				continue;
+			ret = fi_cq_read(ch[i].cq, &entry, 1);
+			if (ret == -FI_EAGAIN)
+				continue;
+			CHK_ERR("fi_cq_read", (ret<0), ret);
+			at[i] = when();
+			done[i] = 1;
+			pending--;
+		}
+	}
+}
+
+/*
+ * Channels 0 .. k-1 contend; with opt.threads each thread drives its own
+ * channel and the leader, which owns channel 0, reads the counter and
+ * reports.
+ */
+static void contend_fetch_add(int k, int repeat)
+{
+	double at[MAX_NUM_CHANNELS];
+	uint64_t final;
+	double t0, t1, t2;
+	int last = ch_last < k ? ch_last : k;
+	int ret;
+	int i, r;
+
+	if (LEADER)
+		contend.base = contended_read(0);
+
+	for (i=ch_first; i<last; i++)
+		*CONTEND_SRC(i) = 1;
+
+	barrier();
+	t1 = when();
+	for (r=0; r<repeat; r++) {
+		t0 = when();
+		for (i=ch_first; i<last; i++) {
+			ret = fi_fetch_atomic(ch[i].tx, CONTEND_SRC(i), 1, NULL,
+					CONTEND_RES(i), NULL,
+					ch[i].peer_addr,
+					ch[0].peer_rma_info.rbuf_addr,
+					ch[0].peer_rma_info.rbuf_key,
+					FI_UINT64, FI_SUM, &ch[i].sctxt);
+			CHK_ERR("fi_fetch_atomic", (ret<0), ret);
+		}
+		contend_reap(ch_first, last, at);
+		for (i=ch_first; i<last; i++)
+			contend.lat[r * k + i] = at[i] - t0;
+	}
+	barrier();
+	t2 = when();
+
+	if (!LEADER)
+		return;
+
+	final = contended_read(0);
+
+	printf("fetch-add %2d contenders (x %4d): %8.2lf Mops/s, counter %s\n",
+		k, repeat, k * repeat / (t2 - t1),
+		(final - contend.base == (uint64_t)k * repeat) ? "ok" : "MISMATCH");
+	print_dist("latency", contend.lat, (long)k * repeat);
+	record("contend_fetch_add", k, sizeof(uint64_t), repeat, 0, contend.lat,
+	       (long)k * repeat, 1, 0);
+}
+
+/*
+ * Each channel models a lock/sequence counter client: it tries to move
+ * the shared word from the last value it observed to that value plus
+ * one, and on failure retries with the value returned by the CSWAP.
+ */
+static void contend_cswap(int k, int repeat)
+{
+	uint64_t expected[MAX_NUM_CHANNELS];
+	double start[MAX_NUM_CHANNELS];
+	double at[MAX_NUM_CHANNELS];
+	uint64_t final;
+	long attempts = (long)k * repeat, successes = 0;
+	double t0, t1, t2, now;
+	int last = ch_last < k ? ch_last : k;
+	int ret;
+	int i, r;
+
+	if (LEADER)
+		contend.base = contended_read(0);
+
+	barrier();
+	t1 = when();
+	for (i=ch_first; i<last; i++) {
+		expected[i] = contend.base;
+		start[i] = t1;
+		contend.succ[i] = 0;
+	}
+
+	for (r=0; r<repeat; r++) {
+		t0 = when();
+		for (i=ch_first; i<last; i++) {
+			*CONTEND_CMP(i) = expected[i];
+			*CONTEND_SRC(i) = expected[i] + 1;
+			ret = fi_compare_atomic(ch[i].tx, CONTEND_SRC(i), 1, NULL,
+					CONTEND_CMP(i), NULL,
+					CONTEND_RES(i), NULL,
+					ch[i].peer_addr,
+					ch[0].peer_rma_info.rbuf_addr,
+					ch[0].peer_rma_info.rbuf_key,
+					FI_UINT64, FI_CSWAP, &ch[i].sctxt);
+			CHK_ERR("fi_compare_atomic", (ret<0), ret);
+		}
+		contend_reap(ch_first, last, at);
+		for (i=ch_first; i<last; i++) {
+			now = at[i];
+			contend.lat[r * k + i] = now - t0;
+			if (*CONTEND_RES(i) == expected[i]) {
+				contend.acq[(long)i * repeat + contend.succ[i]++] = now - start[i];
+				start[i] = now;
+				expected[i]++;
+			}
+			else {
+				expected[i] = *CONTEND_RES(i);
+			}
+		}
+	}
+	barrier();
+	t2 = when();
+
+	if (!LEADER)
+		return;
+
+	/* pack the acquire latencies of all channels */
+	for (i=0; i<k; i++) {
+		memmove(contend.acq + successes, contend.acq + (long)i * repeat,
+			contend.succ[i] * sizeof(double));
+		successes += contend.succ[i];
+	}
+
+	final = contended_read(0);
+
+	printf("cswap     %2d contenders (x %4d): %8.2lf Mops/s, %8.2lf Macq/s, "
+		"retry rate %5.1lf%%, counter %s\n",
+		k, repeat, attempts / (t2 - t1), successes / (t2 - t1),
+		100.0 * (attempts - successes) / attempts,
+		(final - contend.base == (uint64_t)successes) ? "ok" : "MISMATCH");
+	print_dist("attempt latency", contend.lat, attempts);
+	print_dist("acquire latency", contend.acq, successes);
+	record("contend_cswap", k, sizeof(uint64_t), repeat, 0, contend.lat, attempts, 1, 0);
+	record("contend_cswap_acquire", k, sizeof(uint64_t), repeat, 0, contend.acq,
+	       successes, 1, 0);
+}
+
+static void run_contention_test(void)
+{
+	size_t max_count;
+	int repeat = sweep.iters ? sweep.iters : 1000;
+	int k;
+
+	if (fi_fetch_atomicvalid(ch[ch_first].tx, FI_UINT64, FI_SUM, &max_count) ||
+	    fi_compare_atomicvalid(ch[ch_first].tx, FI_UINT64, FI_CSWAP, &max_count)) {
+		if (LEADER)
+			printf("FI_SUM/FI_CSWAP on FI_UINT64 not supported\n");
+		return;
+	}
+
+	if (opt.client) {
+		if (LEADER) {
+			contend.lat = malloc(sizeof(double) * repeat * opt.num_ch);
+			contend.acq = malloc(sizeof(double) * repeat * opt.num_ch);
+			CHK_ERR("malloc", (!contend.lat || !contend.acq), -ENOMEM);
+		}
+
+		for (k = 1; k <= opt.num_ch; k = (k < opt.num_ch && k * 2 > opt.num_ch) ? opt.num_ch : k * 2) {
+			contend_fetch_add(k, repeat);
+			contend_cswap(k, repeat);
+		}
+
+		if (LEADER) {
+			free(contend.lat);
+			free(contend.acq);
+		}
+	}
+
+	synchronize();
+}
+
+/*
+ * Keep up to opt.window atomics outstanding on every channel. Each
+ * outstanding op owns a context and, for fetch ops, a result slot in the
+ * upper half of rbuf; both are recycled through a per-channel free list
+ * indexed by the op_context of the completion. When results are kept the
+ * leader takes a sample per window of completions on each of its
+ * channels, in us per operation like the reported time.
+ */
+static void atomic_window(int fetch, int type, int op, size_t count, int repeat)
+{
+	struct fi_cq_tagged_entry entry[MAX_WINDOW];
+	int posted[MAX_NUM_CHANNELS];
+	int completed[MAX_NUM_CHANNELS];
+	size_t bytes = count * sizeof(uint64_t);
+	int nch = ch_last - ch_first;
+	int keep = result.keep && LEADER;
+	long batch_done = 0;
+	double t_batch = when(), now;
+	char *fetched;
+	int done = 0;
+	int slot, ret;
+	int i, k;
+
+	for (i=ch_first; i<ch_last; i++) {
+		posted[i] = completed[i] = 0;
+		ctx_reset(i, opt.window);
+	}
+
+	while (done < ch_last - ch_first) {
+		for (i=ch_first; i<ch_last; i++) {
+			while (posted[i] < repeat && ch[i].nfree) {
+				slot = ctx_get(i);
+				fetched = ch[i].rbuf + MAX_MSG_SIZE / 2 + slot * bytes;
+				if (fetch)
+					ret = fi_fetch_atomic(ch[i].tx, ch[i].sbuf, count, NULL,
+							fetched, NULL,
+							ch[i].peer_addr,
+							ch[i].peer_rma_info.rbuf_addr,
+							ch[i].peer_rma_info.rbuf_key,
+							type, op, ctx_of(i, slot));
+				else
+					ret = fi_atomic(ch[i].tx, ch[i].sbuf, count, NULL,
+							ch[i].peer_addr,
+							ch[i].peer_rma_info.rbuf_addr,
+							ch[i].peer_rma_info.rbuf_key,
+							type, op, ctx_of(i, slot));
+				if (ret == -FI_EAGAIN) {
+					ctx_put(i, slot);
+					break;
+				}
+				CHK_ERR(fetch ? "fi_fetch_atomic" : "fi_atomic", (ret<0), ret);
+				posted[i]++;
+			}
+
+			if (completed[i] == repeat)
+				continue;
+
+			ret = fi_cq_read(ch[i].cq, entry, opt.window);
+			if (ret == -FI_EAGAIN)
+				continue;
+			CHK_ERR("fi_cq_read", (ret<0), ret);
+
+			for (k=0; k<ret; k++)
+				ctx_done(i, entry[k].op_context);
+
+			completed[i] += ret;
+			if (completed[i] == repeat)
+				done++;
+
+			if (keep) {
+				batch_done += ret;
+				if (batch_done >= (long)opt.window * nch || done == nch) {
+					now = when();
+					add_sample(t_batch, (now - t_batch) * nch / batch_done);
+					t_batch = now;
+					batch_done = 0;
+				}
+			}
+		}
+	}
+}
+
+static void run_atomic_window_sweep(const char *name, int fetch, int op, size_t max_count)
+{
+	size_t count;
+	double t1, t2, t;
+	char test[64];
+	int repeat;
+
+	if (max_count > MAX_MSG_SIZE / 2 / opt.window / sizeof(uint64_t))
+		max_count = MAX_MSG_SIZE / 2 / opt.window / sizeof(uint64_t);
+
+	for (count = 1; count <= max_count; count = count << 1) {
+		repeat = sweep.iters ? sweep.iters : 10 * default_iters(count * sizeof(uint64_t));
+
+		if (LEADER) {
+			printf("atomic %s u64x%-4zu (x %5d, window %3d): ", name, count,
+				repeat, opt.window);
+			fflush(stdout);
+			samples.n = 0;
+			samples.per_ch = 0;
+		}
+		barrier();
+		t1 = when();
+		atomic_window(fetch, FI_UINT64, op, count, repeat);
+		barrier();
+		t2 = when();
+		if (!LEADER)
+			continue;
+
+		t = (t2 - t1) / repeat;
+		printf("%8.2lf us/op, %8.2lf Mops/s, %8.2lf MB/s\n", t,
+			opt.num_ch / t, (count * sizeof(uint64_t) * opt.num_ch) / t);
+		snprintf(test, sizeof(test), "atomic_window_%s", name);
+		record(test, opt.window, count * sizeof(uint64_t), repeat, t, samples.v,
+		       samples.n, 1, 0);
+	}
+}
+
+/*
+ * Throughput rather than latency: only the initiating side posts, the
+ * target stays in synchronize() to drive progress.
+ */
+static void run_atomic_window_test(void)
+{
+	size_t max_count;
+
+	if (opt.client || opt.bidir) {
+		if (!fi_atomicvalid(ch[ch_first].tx, FI_UINT64, FI_ATOMIC_WRITE, &max_count))
+			run_atomic_window_sweep("write", 0, FI_ATOMIC_WRITE, max_count);
+
+		if (!fi_fetch_atomicvalid(ch[ch_first].tx, FI_UINT64, FI_ATOMIC_READ, &max_count))
+			run_atomic_window_sweep("read", 1, FI_ATOMIC_READ, max_count);
+	}
+
+	synchronize();
+}
+
+static void atomic_write_iter(int count, int arg)
+{
+	if (opt.client) {
+		atomic_one(FI_UINT64, FI_ATOMIC_WRITE, count);
+		if (opt.bidir)
+			wait_one();
+	}
+	else {
+		wait_one();
+		 if (opt.bidir) {
+			atomic_one(FI_UINT64, FI_ATOMIC_WRITE, count);
+		}
+	}
+}
+
+static void atomic_read_iter(int count, int arg)
+{
+	fetch_atomic_one(FI_UINT64, FI_ATOMIC_READ, count);
+}
+
+static void run_atomic_test(void)
+{
+	size_t count;
+	size_t max_count;
+	double t;
+	int repeat;
+
+	exchange_rma_info();
+
+	synchronize();
+
+	if (opt.window) {
+		run_atomic_window_test();
+		return;
+	}
+
+	if (opt.matrix) {
+		run_atomic_matrix();
+		return;
+	}
+
+	if (opt.contend) {
+		run_contention_test();
+		return;
+	}
+
+	if (!fi_atomicvalid(ch[ch_first].tx, FI_UINT64, FI_ATOMIC_WRITE, &max_count)) {
+		for (count = 1; count <= max_count; count = count << 1) {
+			t = run_point(atomic_write_iter, count, 0, count * sizeof(uint64_t),
+				      POINT_PAIRED, &repeat);
+			if (!LEADER)
+				continue;
+
+			printf("atomic write u64x%-4zu (x %4d): %8.2lf us, %8.2lf MB/s\n",
+				count, repeat, t, (count * sizeof(uint64_t))/t);
+			record_point("atomic_write", count, count * sizeof(uint64_t), repeat, t, 1);
+		}
+	}
+
+	synchronize();
+
+	if (!fi_fetch_atomicvalid(ch[ch_first].tx, FI_UINT64, FI_ATOMIC_READ, &max_count)) {
+		if (opt.client || opt.bidir) {
+			for (count = 1; count <= max_count; count = count << 1) {
+				t = run_point(atomic_read_iter, count, 0, count * sizeof(uint64_t),
+					      POINT_LOCAL, &repeat);
+				if (!LEADER)
+					continue;
+
+				printf("atomic read u64x%-4zu (x %4d): %8.2lf us, %8.2lf MB/s\n",
+					count, repeat, t, (count * sizeof(uint64_t))/t);
+				record_point("atomic_read", count, count * sizeof(uint64_t), repeat, t, 1);
+			}
+		}
+	}
+	
+	synchronize();
+}
+
+/****************************
+ *	Scatter-Gather Test
+ ****************************/
+
+/*
+ * Segment k of an iov with the given total size starts at offset 2*k*seg,
+ * i.e. the segments are separated by gaps of the same length. This needs
+ * a buffer of 2*size bytes, so sizes are limited to buf_size/2.
+ */
+static void build_iov(struct iovec *iov, char *buf, int size, int count)
+{
+	int seg = size / count;
+	int k;
+
+	for (k=0; k<count; k++) {
+		iov[k].iov_base = buf + k * seg * 2;
+		iov[k].iov_len = (k == count - 1) ? size - seg * (count - 1) : seg;
+	}
+}
+
+static void pack_iov_generic(char *dst, const struct iovec *iov, int count)
+{
+	int k;
+
+	for (k=0; k<count; k++) {
+		memcpy(dst, iov[k].iov_base, iov[k].iov_len);
+		dst += iov[k].iov_len;
+	}
+}
+
+static void unpack_iov_generic(const struct iovec *iov, int count, char *src)
+{
+	int k;
+
+	for (k=0; k<count; k++) {
+		memcpy(iov[k].iov_base, src, iov[k].iov_len);
+		src += iov[k].iov_len;
+	}
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static inline void copy_avx2(char *dst, const char *src, size_t len)
+{
+	while (len >= 128) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(src));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + 32));
+		__m256i c = _mm256_loadu_si256((const __m256i *)(src + 64));
+		__m256i d = _mm256_loadu_si256((const __m256i *)(src + 96));
+		_mm256_storeu_si256((__m256i *)(dst), a);
+		_mm256_storeu_si256((__m256i *)(dst + 32), b);
+		_mm256_storeu_si256((__m256i *)(dst + 64), c);
+		_mm256_storeu_si256((__m256i *)(dst + 96), d);
+		src += 128;
+		dst += 128;
+		len -= 128;
+	}
+	while (len >= 32) {
+		_mm256_storeu_si256((__m256i *)dst,
+				    _mm256_loadu_si256((const __m256i *)src));
+		src += 32;
+		dst += 32;
+		len -= 32;
+	}
+	if (len)
+		memcpy(dst, src, len);
+}
+
+__attribute__((target("avx2")))
+static void pack_iov_avx2(char *dst, const struct iovec *iov, int count)
+{
+	int k;
+
+	for (k=0; k<count; k++) {
+		copy_avx2(dst, iov[k].iov_base, iov[k].iov_len);
+		dst += iov[k].iov_len;
+	}
+}
+
+__attribute__((target("avx2")))
+static void unpack_iov_avx2(const struct iovec *iov, int count, char *src)
+{
+	int k;
+
+	for (k=0; k<count; k++) {
+		copy_avx2(iov[k].iov_base, src, iov[k].iov_len);
+		src += iov[k].iov_len;
+	}
+}
+
+__attribute__((target("avx512f")))
+static inline void copy_avx512(char *dst, const char *src, size_t len)
+{
+	while (len >= 256) {
+		__m512i a = _mm512_loadu_si512((const void *)(src));
+		__m512i b = _mm512_loadu_si512((const void *)(src + 64));
+		__m512i c = _mm512_loadu_si512((const void *)(src + 128));
+		__m512i d = _mm512_loadu_si512((const void *)(src + 192));
+		_mm512_storeu_si512((void *)(dst), a);
+		_mm512_storeu_si512((void *)(dst + 64), b);
+		_mm512_storeu_si512((void *)(dst + 128), c);
+		_mm512_storeu_si512((void *)(dst + 192), d);
+		src += 256;
+		dst += 256;
+		len -= 256;
+	}
+	while (len >= 64) {
+		_mm512_storeu_si512((void *)dst, _mm512_loadu_si512((const void *)src));
+		src += 64;
+		dst += 64;
+		len -= 64;
+	}
+	if (len)
+		memcpy(dst, src, len);
+}
+
+__attribute__((target("avx512f")))
+static void pack_iov_avx512(char *dst, const struct iovec *iov, int count)
+{
+	int k;
+
+	for (k=0; k<count; k++) {
+		copy_avx512(dst, iov[k].iov_base, iov[k].iov_len);
+		dst += iov[k].iov_len;
+	}
+}
+
+__attribute__((target("avx512f")))
+static void unpack_iov_avx512(const struct iovec *iov, int count, char *src)
+{
+	int k;
+
+	for (k=0; k<count; k++) {
+		copy_avx512(iov[k].iov_base, src, iov[k].iov_len);
+		src += iov[k].iov_len;
+	}
+}
+#endif
+
+static void (*pack_iov)(char *dst, const struct iovec *iov, int count) = pack_iov_generic;
+static void (*unpack_iov)(const struct iovec *iov, int count, char *src) = unpack_iov_generic;
+static const char *pack_kernel = "generic";
+
+static void init_pack_kernel(void)
+{
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		pack_iov = pack_iov_avx512;
+		unpack_iov = unpack_iov_avx512;
+		pack_kernel = "avx512";
+	}
+	else if (__builtin_cpu_supports("avx2")) {
+		pack_iov = pack_iov_avx2;
+		unpack_iov = unpack_iov_avx2;
+		pack_kernel = "avx2";
+	}
+#endif
+}
+
+typedef void (*iov_op_t)(int size, int count);
+
+static void sendv_one(int size, int count)
+{
+	int ret;
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		ret = fi_sendv(ch[i].tx, ch[i].siov, NULL, count, ch[i].peer_addr,
+				&ch[i].sctxt);
+		CHK_ERR("fi_sendv", (ret<0), ret);
+	}
+
+	for (i=ch_first; i<ch_last; i++) {
+		WAIT_CQ(ch[i].cq, 1);
+		STAMP(i);
+	}
+}
+
+static void pack_send_one(int size, int count)
+{
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		pack_iov(ch[i].bbuf, ch[i].siov, count);
+		SEND_MSG(ch[i].tx, ch[i].bbuf, size, ch[i].peer_addr, &ch[i].sctxt);
+	}
+
+	for (i=ch_first; i<ch_last; i++) {
+		WAIT_CQ(ch[i].cq, 1);
+		STAMP(i);
+	}
+}
+
+static void writev_one(int size, int count)
+{
+	int ret;
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		ret = fi_writev(ch[i].tx, ch[i].siov, NULL, count, ch[i].peer_addr,
+				ch[i].peer_rma_info.rbuf_addr,
+				ch[i].peer_rma_info.rbuf_key,
+				&ch[i].sctxt);
+		CHK_ERR("fi_writev", (ret<0), ret);
+
+		WAIT_CQ(ch[i].cq, 1);
+		STAMP(i);
+	}
+}
+
+static void writemsg_one(int size, int count)
+{
+	struct fi_msg_rma msg;
+	struct fi_rma_iov rma_iov;
+	int ret;
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		rma_iov.addr = ch[i].peer_rma_info.rbuf_addr;
+		rma_iov.len = size;
+		rma_iov.key = ch[i].peer_rma_info.rbuf_key;
+
+		msg.msg_iov = ch[i].siov;
+		msg.desc = NULL;
+		msg.iov_count = count;
+		msg.addr = ch[i].peer_addr;
+		msg.rma_iov = &rma_iov;
+		msg.rma_iov_count = 1;
+		msg.context = &ch[i].sctxt;
+		msg.data = 0;
+
+		ret = fi_writemsg(ch[i].tx, &msg, 0);
+		CHK_ERR("fi_writemsg", (ret<0), ret);
+
+		WAIT_CQ(ch[i].cq, 1);
+		STAMP(i);
+	}
+}
+
+static void pack_write_one(int size, int count)
+{
+	int ret;
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		pack_iov(ch[i].bbuf, ch[i].siov, count);
+		ret = fi_write(ch[i].tx, ch[i].bbuf, size, NULL, ch[i].peer_addr,
+				ch[i].peer_rma_info.rbuf_addr,
+				ch[i].peer_rma_info.rbuf_key,
+				&ch[i].sctxt);
+		CHK_ERR("fi_write", (ret<0), ret);
+
+		WAIT_CQ(ch[i].cq, 1);
+		STAMP(i);
+	}
+}
+
+static void readv_one(int size, int count)
+{
+	int ret;
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		ret = fi_readv(ch[i].tx, ch[i].riov, NULL, count, ch[i].peer_addr,
+				ch[i].peer_rma_info.sbuf_addr,
+				ch[i].peer_rma_info.sbuf_key,
+				&ch[i].rctxt);
+		CHK_ERR("fi_readv", (ret<0), ret);
+
+		WAIT_CQ(ch[i].cq, 1);
+		STAMP(i);
+	}
+}
+
+static void read_unpack_one(int size, int count)
+{
+	int ret;
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		ret = fi_read(ch[i].tx, ch[i].bbuf, size, NULL, ch[i].peer_addr,
+				ch[i].peer_rma_info.sbuf_addr,
+				ch[i].peer_rma_info.sbuf_key,
+				&ch[i].rctxt);
+		CHK_ERR("fi_read", (ret<0), ret);
+
+		WAIT_CQ(ch[i].cq, 1);
+
+		unpack_iov(ch[i].riov, count, ch[i].bbuf);
+		STAMP(i);
+	}
+}
+
+static void send_contig_one(int size, int count)
+{
+	send_one(size);
+}
+
+/* how the msg iterations receive: contiguous, scattered, or unpacked */
+#define IOV_RECV_CONTIG		0
+#define IOV_RECV_SCATTER	1
+#define IOV_RECV_UNPACK		2
+
+static iov_op_t iov_op;		/* operation timed by the iov iterations */
+static int iov_recv;
+
+static void iov_post_recv(int size, int count)
+{
+	int ret;
+	int i;
+
+	for (i=ch_first; i<ch_last; i++) {
+		if (iov_recv == IOV_RECV_SCATTER) {
+			ret = fi_recvv(ch[i].rx, ch[i].riov, NULL, count, ch[i].peer_addr,
+					&ch[i].rctxt);
+			CHK_ERR("fi_recvv", (ret<0), ret);
+		}
+		else if (iov_recv == IOV_RECV_UNPACK) {
+			RECV_MSG(ch[i].rx, ch[i].bbuf, size, ch[i].peer_addr, &ch[i].rctxt);
+		}
+		else {
+			RECV_MSG(ch[i].rx, ch[i].rbuf, size, ch[i].peer_addr, &ch[i].rctxt);
+		}
+	}
+}
+
+/* called once channel i's receive has completed */
+static void iov_finish_recv(int i, int count)
+{
+	if (iov_recv == IOV_RECV_UNPACK)
+		unpack_iov(ch[i].riov, count, ch[i].bbuf);
+}
+
+static void iov_recv_one(int size, int count)
+{
+	int i;
+
+	iov_post_recv(size, count);
+
+	for (i=ch_first; i<ch_last; i++) {
+		WAIT_CQ(ch[i].cq, 1);
+		iov_finish_recv(i, count);
+		STAMP(i);
+	}
+}
+
+static void iov_msg_iter(int size, int count)
+{
+	int i;
+
+	if (SYMMETRIC) {
+		iov_post_recv(size, count);
+		iov_op(size, count);
+		for (i=ch_first; i<ch_last; i++) {
+			WAIT_CQ(ch[i].cq, 1);
+			iov_finish_recv(i, count);
+		}
+	}
+	else if (opt.client) {
+		iov_recv_one(size, count);
+		iov_op(size, count);
+	}
+	else {
+		iov_op(size, count);
+		iov_recv_one(size, count);
+	}
+}
+
+static void iov_write_iter(int size, int count)
+{
+	if (opt.client) {
+		iov_op(size, count);
+		if (opt.bidir)
+			wait_one();
+	}
+	else {
+		wait_one();
+		if (opt.bidir)
+			iov_op(size, count);
+	}
+}
+
+static void iov_read_iter(int size, int count)
+{
+	iov_op(size, count);
+}
+
+/* double the iov count, but land the last step on max_count */
+static int next_iov_count(int count, int max_count)
+{
+	if (count >= max_count)
+		return max_count + 1;
+
+	return count * 2 < max_count ? count * 2 : max_count;
+}
+
+/*
+ * Time the hardware gather/scatter operation against the equivalent
+ * packing copy through the bounce buffer for every iov count and size.
+ * The msg iterations take the receive side from hw_recv and pack_recv.
+ * For each iov count the smallest size from which the hardware path
+ * stays ahead is reported as the crossover point.
+ */
+static void run_iov_sweep(const char *name, iov_op_t hw_op, iov_op_t pack_op,
+			  int hw_recv, int pack_recv, iter_fn_t iter, int mode, int div)
+{
+	int size, count, max_count;
+	int repeat_hw, repeat_pack, i, k;
+	int crossover;
+	double t_hw, t_pack;
+	size_t limit;
+	const char *hw;
+	char test[64];
+
+	if (hw_recv == IOV_RECV_SCATTER) {
+		limit = fi->rx_attr->iov_limit;
+		hw = "scatter";
+	}
+	else if (iter == iov_read_iter) {
+		limit = fi->tx_attr->iov_limit;
+		hw = "scatter";
+	}
+	else {
+		limit = fi->tx_attr->iov_limit;
+		hw = "gather";
+	}
+	max_count = limit < MAX_IOV ? limit : MAX_IOV;
+
+	for (count = 1; count <= max_count; count = next_iov_count(count, max_count)) {
+		crossover = -1;
+		for (k=0; k<sweep.num_sizes; k++) {
+			size = sweep.sizes[k];
+			if (size < count || size > buf_size / 2)
+				continue;
+
+			for (i=ch_first; i<ch_last; i++) {
+				build_iov(ch[i].siov, ch[i].sbuf, size, count);
+				build_iov(ch[i].riov, ch[i].rbuf, size, count);
+			}
+
+			iov_op = hw_op;
+			iov_recv = hw_recv;
+			t_hw = run_point(iter, size, count, size, mode, &repeat_hw) / div;
+			record_point(name, count, size, repeat_hw, t_hw, div);
+			iov_op = pack_op;
+			iov_recv = pack_recv;
+			t_pack = run_point(iter, size, count, size, mode, &repeat_pack) / div;
+			snprintf(test, sizeof(test), "%s_pack", name);
+			record_point(test, count, size, repeat_pack, t_pack, div);
+			if (!LEADER)
+				continue;
+
+			printf("%-8s %-8d iov %-2d (x %4d/%4d): %s %8.2lf us, pack %8.2lf us, "
+				"%8.2lf MB/s (%s)\n", name, size, count, repeat_hw, repeat_pack,
+				hw, t_hw, t_pack, size/t_hw, t_hw <= t_pack ? hw : "pack");
+
+			if (t_hw > t_pack)
+				crossover = -1;
+			else if (crossover < 0)
+				crossover = size;
+		}
+
+		if (!LEADER)
+			continue;
+		if (crossover < 0)
+			printf("%-8s iov %-2d: packing wins at all sizes\n", name, count);
+		else
+			printf("%-8s iov %-2d: %s wins from %d bytes\n", name, count, hw, crossover);
+	}
+}
+
+static void run_iov_test(void)
+{
+	if (LEADER)
+		printf("iov_limit = %zu, rx iov_limit = %zu, rma_iov_limit = %zu, pack kernel = %s\n",
+		fi->tx_attr->iov_limit, fi->rx_attr->iov_limit, fi->tx_attr->rma_iov_limit,
+		pack_kernel);
+
+	exchange_rma_info();
+
+	synchronize();
+
+	run_iov_sweep("sendv", sendv_one, pack_send_one, IOV_RECV_CONTIG, IOV_RECV_CONTIG,
+		      iov_msg_iter, POINT_PAIRED, 2);
+
+	synchronize();
+
+	run_iov_sweep("recvv", send_contig_one, send_contig_one, IOV_RECV_SCATTER,
+		      IOV_RECV_UNPACK, iov_msg_iter, POINT_PAIRED, 2);
+
+	synchronize();
+
+	run_iov_sweep("writev", writev_one, pack_write_one, IOV_RECV_CONTIG, IOV_RECV_CONTIG,
+		      iov_write_iter, POINT_PAIRED, 1);
+
+	synchronize();
+
+	run_iov_sweep("writemsg", writemsg_one, pack_write_one, IOV_RECV_CONTIG,
+		      IOV_RECV_CONTIG, iov_write_iter, POINT_PAIRED, 1);
+
+	synchronize();
+
+	if (opt.client || opt.bidir)
+		run_iov_sweep("readv", readv_one, read_unpack_one, IOV_RECV_CONTIG,
+			      IOV_RECV_CONTIG, iov_read_iter, POINT_LOCAL, 1);
+
+	synchronize();
+}
+
+/****************************
+ *	Incast Test
+ ****************************/
+
+/*
+ * Ranks 1 .. m send a stream to rank 0's first endpoint, the one the
+ * ranks found at the well-known address, keeping a window of messages
+ * in flight. Rank 0 keeps a window of receives posted there and reposts
+ * as they complete, so with more senders than posted receives the
+ * provider has to buffer or push back; the senders count the
+ * -FI_EAGAIN retries this causes.
+ */
+#define INCAST_WINDOW	    16
+
+struct stream_stats {
+	double	elapsed;	/* us for the whole stream */
+	double	lat_mean;	/* post to send completion, us */
+	double	lat_max;
+	long	retries;	/* sends refused with -FI_EAGAIN */
+};
+
+/* stream repeat messages to dest on channel 0, also used by the mrecv test */
+static void stream_send(fi_addr_t dest, int tagged, int size, int repeat, int window,
+			struct stream_stats *st)
+{
+	struct fi_cq_tagged_entry entry[MAX_WINDOW];
+	double posted_at[MAX_WINDOW];
+	double t1, now, lat;
+	int posted = 0, completed = 0;
+	int slot, ret;
+	int k;
+
+	ctx_reset(0, window);
+
+	memset(st, 0, sizeof(*st));
+	t1 = when();
+
+	while (completed < repeat) {
+		while (posted < repeat && ch[0].nfree) {
+			slot = ctx_get(0);
+			if (tagged)
+				ret = fi_tsend(ch[0].tx, ch[0].sbuf, size, NULL, dest,
+					       MSG_TAG, ctx_of(0, slot));
+			else
+				ret = fi_send(ch[0].tx, ch[0].sbuf, size, NULL, dest,
+					      ctx_of(0, slot));
+			if (ret == -FI_EAGAIN) {
+				ctx_put(0, slot);
+				st->retries++;
+				break;
+			}
+			CHK_ERR(tagged ? "fi_tsend" : "fi_send", (ret<0), ret);
+			posted_at[slot] = when();
+			posted++;
+		}
+
+		ret = fi_cq_read(ch[0].cq, entry, window);
+		if (ret == -FI_EAGAIN)
+			continue;
+		CHK_ERR("fi_cq_read", (ret<0), ret);
+
+		now = when();
+		for (k=0; k<ret; k++) {
+			slot = ctx_slot(0, entry[k].op_context);
+			ctx_put(0, slot);
+			lat = now - posted_at[slot];
+			st->lat_mean += lat;
+			if (lat > st->lat_max)
+				st->lat_max = lat;
+		}
+		completed += ret;
+	}
+
+	st->elapsed = when() - t1;
+	st->lat_mean /= repeat;
+}
+
+/* rank 0: take total messages on channel 0, return the us it took */
+static double incast_serve(int size, int total, int window)
+{
+	struct fi_cq_tagged_entry entry[MAX_WINDOW];
+	int posted = 0, completed = 0;
+	double t1;
+	int slot, ret;
+	int k;
+
+	ctx_reset(0, window);
+
+	t1 = when();
+
+	while (completed < total) {
+		/* never post more than will be consumed, the next sync needs ch[0] */
+		while (posted < total && ch[0].nfree) {
+			slot = ctx_get(0);
+			if (opt.tag)
+				ret = fi_trecv(ch[0].rx, ch[0].rbuf, size, NULL, FI_ADDR_UNSPEC,
+					       MSG_TAG, 0x0ULL, ctx_of(0, slot));
+			else
+				ret = fi_recv(ch[0].rx, ch[0].rbuf, size, NULL, FI_ADDR_UNSPEC,
+					      ctx_of(0, slot));
+			if (ret == -FI_EAGAIN) {
+				ctx_put(0, slot);
+				break;
+			}
+			CHK_ERR(opt.tag ? "fi_trecv" : "fi_recv", (ret<0), ret);
+			posted++;
+		}
+
+		ret = fi_cq_read(ch[0].cq, entry, window);
+		if (ret == -FI_EAGAIN)
+			continue;
+		CHK_ERR("fi_cq_read", (ret<0), ret);
+
+		for (k=0; k<ret; k++)
+			ctx_done(0, entry[k].op_context);
+		completed += ret;
+	}
+
+	return when() - t1;
+}
+
+/* rank 0: collect the senders' stats and print the round */
+static void incast_report(int m, int size, int repeat, double elapsed)
+{
+	struct stream_stats st[MAX_NUM_CHANNELS];
+	double lat[MAX_NUM_CHANNELS];
+	double rate, sum = 0, sum2 = 0;
+	long retries = 0;
+	int r;
+
+	for (r=1; r<=m; r++) {
+		RECV_MSG(ch[r-1].rx, &st[r-1], sizeof(st[r-1]), ch[r-1].peer_addr,
+			 &ch[r-1].rctxt);
+		WAIT_CQ(ch[r-1].cq, 1);
+
+		rate = repeat / st[r-1].elapsed;
+		sum += rate;
+		sum2 += rate * rate;
+		retries += st[r-1].retries;
+		lat[r-1] = st[r-1].lat_mean;
+	}
+
+	/* Jain's index of the per-sender rates: 1 is perfectly fair, 1/m is one sender */
+	printf("incast %3d x %-8d (x %4d): %8.3lf Mmsg/s, %8.2lf MB/s, fairness %5.3lf, "
+		"retries %ld\n", m, size, repeat, (double)m * repeat / elapsed,
+		(double)m * repeat * size / elapsed, sum * sum / (m * sum2), retries);
+
+	for (r=1; r<=m; r++)
+		printf("    rank %-3d %8.3lf Mmsg/s, latency %8.2lf us (max %8.2lf us), "
+			"retries %ld\n", r, repeat / st[r-1].elapsed, st[r-1].lat_mean,
+			st[r-1].lat_max, st[r-1].retries);
+
+	record("incast", m, size, repeat, elapsed / ((double)m * repeat), lat, m, 1, 0);
+}
+
+static void run_incast_test(void)
+{
+	struct stream_stats st;
+	int window = opt.window ? opt.window : INCAST_WINDOW;
+	int repeat = sweep.iters ? sweep.iters : 1000;
+	double elapsed;
+	int size;
+	int k, m;
+
+	synchronize();
+
+	for (m = 1; m < opt.ranks; m = (m < opt.ranks - 1 && m * 2 > opt.ranks - 1) ? opt.ranks - 1 : m * 2) {
+		for (k=0; k<sweep.num_sizes; k++) {
+			size = sweep.sizes[k];
+
+			/*
+			 * rank 1 reaches rank 0 on the incast endpoint, so it
+			 * sends nothing else until rank 0 has taken the stream
+			 */
+			if (opt.rank == 0) {
+				elapsed = incast_serve(size, m * repeat, window);
+				SEND_MSG(ch[0].tx, &elapsed, sizeof(elapsed), ch[0].peer_addr,
+					 &ch[0].sctxt);
+				WAIT_CQ(ch[0].cq, 1);
+				incast_report(m, size, repeat, elapsed);
+			}
+			else if (opt.rank <= m) {
+				stream_send(rank0_addr, opt.tag, size, repeat, window, &st);
+				if (opt.rank == 1) {
+					RECV_MSG(ch[0].rx, &elapsed, sizeof(elapsed), ch[0].peer_addr,
+						 &ch[0].rctxt);
+					WAIT_CQ(ch[0].cq, 1);
+				}
+				SEND_MSG(ch[0].tx, &st, sizeof(st), ch[0].peer_addr, &ch[0].sctxt);
+				WAIT_CQ(ch[0].cq, 1);
+			}
+
+			synchronize();
+		}
+	}
+}
+
+/****************************
+ *	All-to-all Test
+ ****************************/
+
+/*
+ * Every rank sends a personalized block to every other rank: the sbuf
+ * of the channel to that peer, received into the rbuf of the channel
+ * from it. The schedules differ only in the order and overlap of the
+ * pairwise transfers:
+ *
+ *   naive     all receives and sends posted at once, sends in rank
+ *	       order, so every rank first hits rank 0
+ *   pairwise  step s exchanges with rank ^ s (rank + s / rank - s when
+ *	       the number of ranks is not a power of two); opt.window
+ *	       steps are in flight at a time
+ *   bruck     log2(ranks) rounds of packed blocks to rank + 2^k, for
+ *	       small blocks where the message count dominates
+ */
+#define BRUCK_MAX_SIZE	    4096
+
+static char *a2a_work, *a2a_sbuf, *a2a_rbuf;	/* bruck only */
+
+static void a2a_naive(int size)
+{
+	int p, c;
+
+	for (p=0; p<opt.ranks; p++) {
+		if (p == opt.rank)
+			continue;
+		c = peer_chan(opt.rank, p);
+		RECV_MSG(ch[c].rx, ch[c].rbuf, size, ch[c].peer_addr, &ch[c].rctxt);
+		SEND_MSG(ch[c].tx, ch[c].sbuf, size, ch[c].peer_addr, &ch[c].sctxt);
+	}
+
+	for (c=0; c<opt.num_ch; c++)
+		WAIT_CQ(ch[c].cq, 2);
+}
+
+static void a2a_pairwise(int size)
+{
+	int pending[MAX_NUM_CHANNELS];
+	int window = opt.window ? opt.window : 1;
+	int pow2 = !(opt.ranks & (opt.ranks - 1));
+	int s, s0, dst, src, c;
+
+	for (s0=1; s0<opt.ranks; s0+=window) {
+		memset(pending, 0, sizeof(pending));
+
+		for (s=s0; s<s0+window && s<opt.ranks; s++) {
+			dst = pow2 ? opt.rank ^ s : (opt.rank + s) % opt.ranks;
+			src = pow2 ? opt.rank ^ s : (opt.rank - s + opt.ranks) % opt.ranks;
+
+			c = peer_chan(opt.rank, src);
+			RECV_MSG(ch[c].rx, ch[c].rbuf, size, ch[c].peer_addr, &ch[c].rctxt);
+			pending[c]++;
+
+			c = peer_chan(opt.rank, dst);
+			SEND_MSG(ch[c].tx, ch[c].sbuf, size, ch[c].peer_addr, &ch[c].sctxt);
+			pending[c]++;
+		}
+
+		for (c=0; c<opt.num_ch; c++)
+			if (pending[c])
+				WAIT_CQ(ch[c].cq, pending[c]);
+	}
+}
+
+static void a2a_bruck(int size)
+{
+	int r = opt.rank, P = opt.ranks;
+	int i, j, k, n;
+	int cs, cd;
+
+	/* a2a_work[i] holds the block for rank r + i */
+	for (i=0; i<P; i++) {
+		j = (r + i) % P;
+		memcpy(a2a_work + i * size,
+		       j == r ? ch[0].sbuf : ch[peer_chan(r, j)].sbuf, size);
+	}
+
+	for (k=1; k<P; k<<=1) {
+		for (i=0, n=0; i<P; i++)
+			if (i & k)
+				memcpy(a2a_sbuf + n++ * size, a2a_work + i * size, size);
+
+		cs = peer_chan(r, (r - k + P) % P);
+		cd = peer_chan(r, (r + k) % P);
+		RECV_MSG(ch[cs].rx, a2a_rbuf, n * size, ch[cs].peer_addr, &ch[cs].rctxt);
+		SEND_MSG(ch[cd].tx, a2a_sbuf, n * size, ch[cd].peer_addr, &ch[cd].sctxt);
+		if (cs == cd) {
+			WAIT_CQ(ch[cd].cq, 2);
+		}
+		else {
+			WAIT_CQ(ch[cd].cq, 1);
+			WAIT_CQ(ch[cs].cq, 1);
+		}
+
+		for (i=0, n=0; i<P; i++)
+			if (i & k)
+				memcpy(a2a_work + i * size, a2a_rbuf + n++ * size, size);
+	}
+
+	/* now a2a_work[i] holds the block from rank r - i */
+	for (i=1; i<P; i++)
+		memcpy(ch[peer_chan(r, (r - i + P) % P)].rbuf, a2a_work + i * size, size);
+}
+
+static void alltoall_iter(int size, int schedule)
+{
+	switch (schedule) {
+	case A2A_NAIVE:
+		a2a_naive(size);
+		break;
+
+	case A2A_PAIRWISE:
+		a2a_pairwise(size);
+		break;
+
+	case A2A_BRUCK:
+		a2a_bruck(size);
+		break;
+	}
+}
+
+static void run_alltoall_test(void)
+{
+	int half = opt.ranks / 2;
+	int size, repeat;
+	int a, k;
+	char test[64];
+	double t;
+
+	a2a_work = malloc((size_t)opt.ranks * BRUCK_MAX_SIZE);
+	a2a_sbuf = malloc((size_t)opt.ranks * BRUCK_MAX_SIZE);
+	a2a_rbuf = malloc((size_t)opt.ranks * BRUCK_MAX_SIZE);
+	CHK_ERR("malloc", (!a2a_work || !a2a_sbuf || !a2a_rbuf), -ENOMEM);
+
+	synchronize();
+
+	for (a=0; a<A2A_NUM; a++) {
+		if (opt.schedule >= 0 && a != opt.schedule)
+			continue;
+
+		for (k=0; k<sweep.num_sizes; k++) {
+			size = sweep.sizes[k];
+			if (a == A2A_BRUCK && size > BRUCK_MAX_SIZE)
+				continue;
+
+			t = run_point(alltoall_iter, size, a, (size_t)size * opt.num_ch,
+				      POINT_PAIRED, &repeat);
+
+			/* half of all the data crosses any bisection of the ranks */
+			printf("alltoall %-8s %-8d (x %4d): %8.2lf us, %8.2lf MB/s per rank, "
+				"%8.2lf MB/s bisection\n", a2a_name[a], size, repeat, t,
+				(double)size * opt.num_ch / t,
+				2.0 * half * (opt.ranks - half) * size / t);
+			snprintf(test, sizeof(test), "alltoall_%s", a2a_name[a]);
+			record_point(test, opt.ranks, size, repeat, t, 1);
+		}
+
+		synchronize();
+	}
+
+	free(a2a_work);
+	free(a2a_sbuf);
+	free(a2a_rbuf);
+}
+
+/****************************
+ *	Allreduce Test
+ ****************************/
+
+/*
+ * Sum a vector over all ranks, in place in ar.out from ar.in, with two
+ * algorithms over the per-peer channels:
+ *
+ *   ring  reduce-scatter then allgather around the ring of ranks, each
+ *	   step moving one of P segments to rank + 1
+ *   rd    recursive doubling, exchanging the whole vector with rank ^ k;
+ *	   ranks above the largest power of two first fold into a partner
+ *
+ * Each step is pipelined in AR_CHUNK pieces: the next piece is posted
+ * before the current one is reduced. The time spent in the local copy
+ * and reduction kernels is kept apart, the rest is network time.
+ */
+#define AR_FLOAT	    0
+#define AR_DOUBLE	    1
+#define AR_INT64	    2
+#define AR_NUM_TYPES	    3
+
+#define AR_RING		    0
+#define AR_RD		    1
+#define AR_NUM_ALGOS	    2
+
+#define AR_CHUNK	    (1<<16)
+
+static const char *ar_type_name[AR_NUM_TYPES] = {
+	"float", "double", "int64"
+};
+
+static const size_t ar_type_size[AR_NUM_TYPES] = {
+	sizeof(float), sizeof(double), sizeof(int64_t)
+};
+
+static const char *ar_algo_name[AR_NUM_ALGOS] = {
+	"ring", "rd"
+};
+
+typedef void (*reduce_fn_t)(void *dst, const void *src, size_t n);
+
+static struct {
+	char	*in;
+	char	*out;
+	char	*tmp[2];	/* pipelined pieces; tmp[0] also takes a whole vector */
+	int	type;
+	long	calls;
+	double	t_local;	/* copy and reduction, us */
+} ar;
+
+static void sum_float_generic(void *dst, const void *src, size_t n)
+{
+	float *d = dst;
+	const float *s = src;
+	size_t i;
+
+	for (i=0; i<n; i++)
+		d[i] += s[i];
+}
+
+static void sum_double_generic(void *dst, const void *src, size_t n)
+{
+	double *d = dst;
+	const double *s = src;
+	size_t i;
+
+	for (i=0; i<n; i++)
+		d[i] += s[i];
+}
+
+static void sum_int64_generic(void *dst, const void *src, size_t n)
+{
+	int64_t *d = dst;
+	const int64_t *s = src;
+	size_t i;
+
+	for (i=0; i<n; i++)
+		d[i] += s[i];
+}
+
+#if defined(__x86_64__)
+/* vector body of width w elements, the tail is summed by the generic kernel */
+#define DEFINE_SUM(name, isa, type, vec, w, load, add, store, generic)		\
+	__attribute__((target(isa)))						\
+	static void name(void *dst, const void *src, size_t n)			\
+	{									\
+		type *d = dst;							\
+		const type *s = src;						\
+		size_t i;							\
+										\
+		for (i=0; i + w <= n; i += w) {					\
+			vec a = load((void *)(d + i));				\
+			vec b = load((void *)(s + i));				\
+			store((void *)(d + i), add(a, b));			\
+		}								\
+		generic(d + i, s + i, n - i);					\
+	}
+
+#define LOADU_SI128(p)		_mm_loadu_si128((const __m128i *)(p))
+#define STOREU_SI128(p, v)	_mm_storeu_si128((__m128i *)(p), v)
+#define LOADU_SI256(p)		_mm256_loadu_si256((const __m256i *)(p))
+#define STOREU_SI256(p, v)	_mm256_storeu_si256((__m256i *)(p), v)
+
+DEFINE_SUM(sum_float_sse, "sse2", float, __m128, 4, _mm_loadu_ps, _mm_add_ps, _mm_storeu_ps,
+	   sum_float_generic)
+DEFINE_SUM(sum_double_sse, "sse2", double, __m128d, 2, _mm_loadu_pd, _mm_add_pd, _mm_storeu_pd,
+	   sum_double_generic)
+DEFINE_SUM(sum_int64_sse, "sse2", int64_t, __m128i, 2, LOADU_SI128, _mm_add_epi64, STOREU_SI128,
+	   sum_int64_generic)
+
+DEFINE_SUM(sum_float_avx2, "avx2", float, __m256, 8, _mm256_loadu_ps, _mm256_add_ps,
+	   _mm256_storeu_ps, sum_float_generic)
+DEFINE_SUM(sum_double_avx2, "avx2", double, __m256d, 4, _mm256_loadu_pd, _mm256_add_pd,
+	   _mm256_storeu_pd, sum_double_generic)
+DEFINE_SUM(sum_int64_avx2, "avx2", int64_t, __m256i, 4, LOADU_SI256, _mm256_add_epi64,
+	   STOREU_SI256, sum_int64_generic)
+
+DEFINE_SUM(sum_float_avx512, "avx512f", float, __m512, 16, _mm512_loadu_ps, _mm512_add_ps,
+	   _mm512_storeu_ps, sum_float_generic)
+DEFINE_SUM(sum_double_avx512, "avx512f", double, __m512d, 8, _mm512_loadu_pd, _mm512_add_pd,
+	   _mm512_storeu_pd, sum_double_generic)
+DEFINE_SUM(sum_int64_avx512, "avx512f", int64_t, __m512i, 8, _mm512_loadu_si512,
+	   _mm512_add_epi64, _mm512_storeu_si512, sum_int64_generic)
+#endif
+
+static reduce_fn_t reduce_sum[AR_NUM_TYPES] = {
+	sum_float_generic, sum_double_generic, sum_int64_generic
+};
+static const char *reduce_kernel = "generic";
+
+/* -G keeps the scalar kernels for comparison */
+static void init_reduce_kernel(void)
+{
+	if (opt.generic)
+		return;
+
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		reduce_sum[AR_FLOAT] = sum_float_avx512;
+		reduce_sum[AR_DOUBLE] = sum_double_avx512;
+		reduce_sum[AR_INT64] = sum_int64_avx512;
+		reduce_kernel = "avx512";
+	}
+	else if (__builtin_cpu_supports("avx2")) {
+		reduce_sum[AR_FLOAT] = sum_float_avx2;
+		reduce_sum[AR_DOUBLE] = sum_double_avx2;
+		reduce_sum[AR_INT64] = sum_int64_avx2;
+		reduce_kernel = "avx2";
+	}
+	else {
+		reduce_sum[AR_FLOAT] = sum_float_sse;
+		reduce_sum[AR_DOUBLE] = sum_double_sse;
+		reduce_sum[AR_INT64] = sum_int64_sse;
+		reduce_kernel = "sse2";
+	}
+#endif
+}
+
+static inline void ar_reduce(char *dst, const char *src, size_t len)
+{
+	double t = when();
+
+	reduce_sum[ar.type](dst, src, len / ar_type_size[ar.type]);
+	ar.t_local += when() - t;
+}
+
+static inline size_t ar_piece(size_t len, size_t off)
+{
+	return len - off < AR_CHUNK ? len - off : AR_CHUNK;
+}
+
+/* post the pieces at off of the send and the receive, where there are any */
+static inline void ar_post(int cd, const char *src, size_t slen, int cs, char *dst, size_t rlen,
+			   size_t off)
+{
+	if (off < rlen)
+		RECV_MSG(ch[cs].rx, dst, ar_piece(rlen, off), ch[cs].peer_addr, &ch[cs].rctxt);
+	if (off < slen)
+		SEND_MSG(ch[cd].tx, (void *)(src + off), ar_piece(slen, off), ch[cd].peer_addr,
+			 &ch[cd].sctxt);
+}
+
+static inline void ar_wait(int cd, int sends, int cs, int recvs)
+{
+	if (cd == cs) {
+		if (sends + recvs)
+			WAIT_CQ(ch[cd].cq, sends + recvs);
+	}
+	else {
+		if (sends)
+			WAIT_CQ(ch[cd].cq, sends);
+		if (recvs)
+			WAIT_CQ(ch[cs].cq, recvs);
+	}
+}
+
+/*
+ * Send slen bytes from src to channel cd while receiving rlen bytes from
+ * channel cs, either summed into dst or stored there. The two lengths
+ * differ in the ring when P does not divide the vector; each side is
+ * split into pieces on its own, which matches the peer's split of the
+ * same segment.
+ */
+static void ar_step(int cd, const char *src, size_t slen, int cs, char *dst, size_t rlen,
+		    int reduce)
+{
+	size_t len = slen > rlen ? slen : rlen;
+	size_t off, next;
+	int k;
+
+	if (!len)
+		return;
+
+	ar_post(cd, src, slen, cs, reduce ? ar.tmp[0] : dst, rlen, 0);
+	ar_wait(cd, slen > 0, cs, rlen > 0);
+
+	for (off=0, k=0; off<len; off=next, k++) {
+		next = off + AR_CHUNK;
+		if (next < len)
+			ar_post(cd, src, slen, cs, reduce ? ar.tmp[(k+1) & 1] : dst + next,
+				rlen, next);
+		if (reduce && off < rlen)
+			ar_reduce(dst + off, ar.tmp[k & 1], ar_piece(rlen, off));
+		if (next < len)
+			ar_wait(cd, next < slen, cs, next < rlen);
+	}
+}
+
+static inline size_t ar_seg(size_t n, int k)
+{
+	return n * k / opt.ranks * ar_type_size[ar.type];
+}
+
+static void ar_ring(int size)
+{
+	size_t n = size / ar_type_size[ar.type];
+	int r = opt.rank, P = opt.ranks;
+	int cd = peer_chan(r, (r + 1) % P);
+	int cs = peer_chan(r, (r - 1 + P) % P);
+	int s, ks, kr;
+
+	for (s=0; s<P-1; s++) {
+		ks = (r - s + P) % P;
+		kr = (r - s - 1 + P) % P;
+		ar_step(cd, ar.out + ar_seg(n, ks), ar_seg(n, ks + 1) - ar_seg(n, ks),
+			cs, ar.out + ar_seg(n, kr), ar_seg(n, kr + 1) - ar_seg(n, kr), 1);
+	}
+
+	for (s=0; s<P-1; s++) {
+		ks = (r - s + 1 + P) % P;
+		kr = (r - s + P) % P;
+		ar_step(cd, ar.out + ar_seg(n, ks), ar_seg(n, ks + 1) - ar_seg(n, ks),
+			cs, ar.out + ar_seg(n, kr), ar_seg(n, kr + 1) - ar_seg(n, kr), 0);
+	}
+}
+
+static void ar_rd(int size)
+{
+	int r = opt.rank, P = opt.ranks;
+	int p2, c, k;
+
+	for (p2=1; p2 * 2 <= P; p2 <<= 1)
+		;
+
+	if (r >= p2) {
+		c = peer_chan(r, r - p2);
+		SEND_MSG(ch[c].tx, ar.out, size, ch[c].peer_addr, &ch[c].sctxt);
+		WAIT_CQ(ch[c].cq, 1);
+		RECV_MSG(ch[c].rx, ar.out, size, ch[c].peer_addr, &ch[c].rctxt);
+		WAIT_CQ(ch[c].cq, 1);
+		return;
+	}
+
+	if (r + p2 < P) {
+		c = peer_chan(r, r + p2);
+		RECV_MSG(ch[c].rx, ar.tmp[0], size, ch[c].peer_addr, &ch[c].rctxt);
+		WAIT_CQ(ch[c].cq, 1);
+		ar_reduce(ar.out, ar.tmp[0], size);
+	}
+
+	for (k=1; k<p2; k<<=1) {
+		c = peer_chan(r, r ^ k);
+		ar_step(c, ar.out, size, c, ar.out, size, 1);
+	}
+
+	if (r + p2 < P) {
+		c = peer_chan(r, r + p2);
+		SEND_MSG(ch[c].tx, ar.out, size, ch[c].peer_addr, &ch[c].sctxt);
+		WAIT_CQ(ch[c].cq, 1);
+	}
+}
+
+/* arg is algo * AR_NUM_TYPES + type */
+static void allreduce_iter(int size, int arg)
+{
+	double t = when();
+
+	memcpy(ar.out, ar.in, size);
+	ar.t_local += when() - t;
+	ar.calls++;
+
+	if (arg / AR_NUM_TYPES == AR_RING)
+		ar_ring(size);
+	else
+		ar_rd(size);
+}
+
+/* every rank contributes rank + 1 to each element */
+static void ar_fill(int type, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		if (type == AR_FLOAT)
+			((float *)ar.in)[i] = opt.rank + 1;
+		else if (type == AR_DOUBLE)
+			((double *)ar.in)[i] = opt.rank + 1;
+		else
+			((int64_t *)ar.in)[i] = opt.rank + 1;
+	}
+}
+
+static int ar_check(int type, size_t n)
+{
+	double expect = (double)opt.ranks * (opt.ranks + 1) / 2;
+	double v;
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		if (type == AR_FLOAT)
+			v = ((float *)ar.out)[i];
+		else if (type == AR_DOUBLE)
+			v = ((double *)ar.out)[i];
+		else
+			v = ((int64_t *)ar.out)[i];
+		if (v != expect)
+			return 0;
+	}
+	return 1;
+}
+
+static void run_allreduce_test(void)
+{
+	size_t n, bytes;
+	int algo, type, k, repeat;
+	char test[64];
+	double t, local;
+
+	init_reduce_kernel();
+	printf("reduction kernel = %s, chunk = %d\n", reduce_kernel, AR_CHUNK);
+
+	if (posix_memalign((void *) &ar.in, ALIGN, sweep.max_size) ||
+	    posix_memalign((void *) &ar.out, ALIGN, sweep.max_size) ||
+	    posix_memalign((void *) &ar.tmp[0], ALIGN, sweep.max_size > AR_CHUNK ?
+			   sweep.max_size : AR_CHUNK) ||
+	    posix_memalign((void *) &ar.tmp[1], ALIGN, AR_CHUNK)) {
+		fprintf(stderr, "No memory\n");
+		exit(1);
+	}
+
+	synchronize();
+
+	for (algo=0; algo<AR_NUM_ALGOS; algo++) {
+		for (type=0; type<AR_NUM_TYPES; type++) {
+			ar.type = type;
+			for (k=0; k<sweep.num_sizes; k++) {
+				n = sweep.sizes[k] / ar_type_size[type];
+				if (n < (algo == AR_RING ? opt.ranks : 1))
+					continue;
+
+				bytes = n * ar_type_size[type];
+				ar_fill(type, n);
+				ar.calls = 0;
+				ar.t_local = 0;
+
+				t = run_point(allreduce_iter, bytes, algo * AR_NUM_TYPES + type,
+					      bytes, POINT_PAIRED, &repeat);
+				local = ar.t_local / ar.calls;
+
+				printf("allreduce %-4s %-6s %-8zu (x %4d): %8.2lf us (local %8.2lf us, "
+					"network %8.2lf us), %8.2lf MB/s %s\n",
+					ar_algo_name[algo], ar_type_name[type], bytes, repeat, t,
+					local, t - local, bytes / t,
+					ar_check(type, n) ? "ok" : "MISMATCH");
+				snprintf(test, sizeof(test), "allreduce_%s_%s", ar_algo_name[algo],
+					 ar_type_name[type]);
+				record_point(test, opt.ranks, bytes, repeat, t, 1);
+			}
+			synchronize();
+		}
+	}
+
+	free(ar.in);
+	free(ar.out);
+	free(ar.tmp[0]);
+	free(ar.tmp[1]);
+}
+
+/****************************
+ *	Broadcast Test
+ ****************************/
+
+/*
+ * Rank 0 broadcasts a payload with RMA writes down a tree of ranks. Every
+ * rank forwards each chunk to its children as soon as the counter of the
+ * channel from its parent shows the chunk landed, so receiving and
+ * forwarding overlap. A chunk is taken as landed once that many writes
+ * have, which relies on the provider keeping writes in order; without
+ * FI_ORDER_WAW only the flat shape and whole-payload chunks are run. The
+ * leaves acknowledge with a message once all chunks landed, inner ranks
+ * once all their children did, and rank 0 times up to the last ack.
+ */
+#define BC_FLAT		    0	/* rank 0 writes to every rank */
+#define BC_CHAIN	    1	/* rank r to rank r + 1 */
+#define BC_BINARY	    2	/* rank r to ranks 2r + 1 and 2r + 2 */
+#define BC_NUM_SHAPES	    3
+
+#define BC_MIN_CHUNK	    4096
+#define BC_WINDOW	    64	/* writes in flight per child, below the cq size */
+
+static const char *bc_shape_name[BC_NUM_SHAPES] = {
+	"flat", "chain", "binary"
+};
+
+static struct {
+	int		chunk;
+	int		parent;		/* channel, -1 on rank 0 */
+	int		nchild;
+	int		child[MAX_NUM_CHANNELS];	/* channels */
+	int		acks;
+	int		ack[MAX_NUM_CHANNELS];
+	uint64_t	landed[MAX_NUM_CHANNELS];	/* remote writes seen per channel */
+} bc;
+
+static void bc_init_shape(int shape)
+{
+	int r = opt.rank;
+	int p;
+
+	bc.nchild = 0;
+	bc.parent = -1;
+
+	for (p=0; p<opt.ranks; p++) {
+		if (p == r)
+			continue;
+		if ((shape == BC_FLAT && r == 0) ||
+		    (shape == BC_CHAIN && p == r + 1) ||
+		    (shape == BC_BINARY && (p == 2 * r + 1 || p == 2 * r + 2)))
+			bc.child[bc.nchild++] = peer_chan(r, p);
+	}
+
+	if (r == 0)
+		return;
+
+	if (shape == BC_FLAT)
+		p = 0;
+	else if (shape == BC_CHAIN)
+		p = r - 1;
+	else
+		p = (r - 1) / 2;
+	bc.parent = peer_chan(r, p);
+}
+
+/* take the completions of a child channel: acks and finished writes */
+static void bc_reap(int c)
+{
+	struct fi_cq_tagged_entry entry[BC_WINDOW + 1];
+	int ret, k;
+
+	ret = fi_cq_read(ch[c].cq, entry, BC_WINDOW + 1);
+	if (ret == -FI_EAGAIN)
+		return;
+	CHK_ERR("fi_cq_read", (ret<0), ret);
+
+	for (k=0; k<ret; k++) {
+		if (entry[k].op_context == &ch[c].rctxt)
+			bc.acks++;
+		else
+			ctx_done(c, entry[k].op_context);
+	}
+}
+
+static void bc_write(int c, char *src, size_t len, size_t off)
+{
+	int slot, ret;
+
+	while (!ch[c].nfree)
+		bc_reap(c);
+
+	slot = ctx_get(c);
+	do {
+		ret = fi_write(ch[c].tx, src, len, NULL, ch[c].peer_addr,
+			       ch[c].peer_rma_info.rbuf_addr + off,
+			       ch[c].peer_rma_info.rbuf_key, ctx_of(c, slot));
+		if (ret == -FI_EAGAIN)
+			bc_reap(c);
+	} while (ret == -FI_EAGAIN);
+	CHK_ERR("fi_write", (ret<0), ret);
+}
+
+static void bcast_iter(int size, int arg)
+{
+	char *src = bc.parent < 0 ? ch[0].sbuf : ch[bc.parent].rbuf;
+	size_t off, n;
+	int i;
+
+	bc.acks = 0;
+	for (i=0; i<bc.nchild; i++) {
+		RECV_MSG(ch[bc.child[i]].rx, &bc.ack[i], sizeof(bc.ack[i]),
+			 ch[bc.child[i]].peer_addr, &ch[bc.child[i]].rctxt);
+		ctx_reset(bc.child[i], BC_WINDOW);
+	}
+
+	for (off=0; off<size; off+=n) {
+		n = size - off < bc.chunk ? size - off : bc.chunk;
+
+		if (bc.parent >= 0) {
+			while (fi_cntr_read(ch[bc.parent].cntr) <= bc.landed[bc.parent])
+				for (i=0; i<bc.nchild; i++)
+					bc_reap(bc.child[i]);
+			bc.landed[bc.parent]++;
+		}
+
+		for (i=0; i<bc.nchild; i++)
+			bc_write(bc.child[i], src + off, n, off);
+	}
+
+	/* all writes done and every subtree acknowledged */
+	for (i=0; i<bc.nchild; i++)
+		while (ch[bc.child[i]].nfree < BC_WINDOW)
+			bc_reap(bc.child[i]);
+	while (bc.acks < bc.nchild)
+		for (i=0; i<bc.nchild; i++)
+			bc_reap(bc.child[i]);
+
+	if (bc.parent >= 0) {
+		SEND_MSG(ch[bc.parent].tx, &bc.ack[0], sizeof(bc.ack[0]),
+			 ch[bc.parent].peer_addr, &ch[bc.parent].sctxt);
+		WAIT_CQ(ch[bc.parent].cq, 1);
+	}
+}
+
+static void run_bcast_test(void)
+{
+	int shape, size, chunk, repeat, k;
+	int ordered = (fi->tx_attr->msg_order & FI_ORDER_WAW) &&
+		      (fi->rx_attr->msg_order & FI_ORDER_WAW);
+	char test[64];
+	double t;
+
+	exchange_rma_info();
+
+	if (!ordered)
+		printf("note: writes are not ordered (no FI_ORDER_WAW), "
+			"forwarding shapes run unpipelined only\n");
+
+	synchronize();
+
+	for (shape=0; shape<BC_NUM_SHAPES; shape++) {
+		bc_init_shape(shape);
+
+		for (k=0; k<sweep.num_sizes; k++) {
+			size = sweep.sizes[k];
+
+			/* chunk == size is the unpipelined reference */
+			chunk = size < BC_MIN_CHUNK ? size : BC_MIN_CHUNK;
+			if (!ordered && shape != BC_FLAT)
+				chunk = size;
+
+			for (; ; chunk = chunk * 4 < size ? chunk * 4 : size) {
+				bc.chunk = chunk;
+				t = run_point(bcast_iter, size, 0, size, POINT_PAIRED, &repeat);
+
+				printf("bcast %-6s %-8d chunk %-8d (x %4d): %8.2lf us, %8.2lf MB/s\n",
+					bc_shape_name[shape], size, chunk, repeat, t, size / t);
+				snprintf(test, sizeof(test), "bcast_%s_%d", bc_shape_name[shape],
+					 chunk);
+				record_point(test, opt.ranks, size, repeat, t, 1);
+
+				if (chunk == size)
+					break;
+			}
+		}
+
+		synchronize();
+	}
+}
+
+/****************************
+ *	Tag Matching Test
+ ****************************/
+
+/*
+ * The server keeps depth tagged receives outstanding on channel 0 and
+ * the client sends one message to each, so every match searches a queue
+ * of up to depth entries:
+ *
+ *   expected    the receives are posted first, the sends come in
+ *		 forward, reverse or random order of the posted receives
+ *   unexpected  the sends arrive first and wait in the unexpected queue,
+ *		 the receives are then posted in forward, reverse or random
+ *		 order
+ *
+ * With exact matching every receive has its own tag and ignore 0; with
+ * masked matching the receives ignore the low byte, which the sender
+ * fills with noise. The tags never match MSG_TAG, which keeps carrying
+ * the control messages. The server times each round and reports the
+ * cost per message. Expected rounds are timed from the first arrival,
+ * so the hop of the go message is left out and depth starts at 4.
+ */
+#define TM_SIZE		    64
+#define TM_TAG		    (0x5A00000000000000ULL)
+
+#define TM_EXPECTED	    0
+#define TM_UNEXPECTED	    1
+
+#define TM_FORWARD	    0
+#define TM_REVERSE	    1
+#define TM_RANDOM	    2
+#define TM_NUM_ORDERS	    3
+
+static const char *tm_order_name[TM_NUM_ORDERS] = {
+	"forward", "reverse", "random"
+};
+
+static op_ctx_t tm_ctxt[TM_MAX_DEPTH];
+static int tm_perm[TM_MAX_DEPTH];
+
+/* the same permutation on both sides for a given depth */
+static void tm_order(int order, int depth)
+{
+	uint32_t x = 2463534242U ^ depth;
+	int i, j, tmp;
+
+	for (i=0; i<depth; i++)
+		tm_perm[i] = (order == TM_REVERSE) ? depth - 1 - i : i;
+
+	if (order != TM_RANDOM)
+		return;
+
+	for (i=depth-1; i>0; i--) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		j = x % (i + 1);
+		tmp = tm_perm[i];
+		tm_perm[i] = tm_perm[j];
+		tm_perm[j] = tmp;
+	}
+}
+
+static inline uint64_t tm_tag(int i, int masked)
+{
+	return masked ? TM_TAG | ((uint64_t)i << 8) : TM_TAG | i;
+}
+
+static void tm_post_recvs(int depth, int masked, int use_perm)
+{
+	int i, k, ret;
+
+	for (k=0; k<depth; k++) {
+		i = use_perm ? tm_perm[k] : k;
+		ret = fi_trecv(ch[0].rx, ch[0].rbuf + i * TM_SIZE, TM_SIZE, NULL,
+			       ch[0].peer_addr, tm_tag(i, masked), masked ? 0xFFULL : 0,
+			       &tm_ctxt[i]);
+		CHK_ERR("fi_trecv", (ret<0), ret);
+	}
+}
+
+static void tm_send_all(int depth, int masked, int use_perm)
+{
+	struct fi_cq_tagged_entry entry[TM_MAX_DEPTH];
+	int completed = 0;
+	int i, k, ret;
+
+	for (k=0; k<depth; k++) {
+		i = use_perm ? tm_perm[k] : k;
+		while ((ret = fi_tsend(ch[0].tx, ch[0].sbuf, TM_SIZE, NULL, ch[0].peer_addr,
+				       tm_tag(i, masked) | (masked ? (k * 37) & 0xFF : 0),
+				       &tm_ctxt[i])) == -FI_EAGAIN) {
+			ret = fi_cq_read(ch[0].cq, entry, depth);
+			if (ret > 0)
+				completed += ret;
+			else if (ret != -FI_EAGAIN)
+				CHK_ERR("fi_cq_read", (ret<0), ret);
+		}
+		CHK_ERR("fi_tsend", (ret<0), ret);
+	}
+
+	if (depth > completed)
+		WAIT_CQ(ch[0].cq, depth - completed);
+}
+
+/* reap the go send and the depth receives, timing from the first arrival */
+static double tm_wait_expected(int depth)
+{
+	struct fi_cq_tagged_entry entry[TM_MAX_DEPTH + 1];
+	double t1 = 0;
+	int matched = 0, completed = 0;
+	int k, ret;
+
+	while (completed < depth + 1) {
+		ret = PHASE(PH_CQ, fi_cq_read(ch[0].cq, entry, depth + 1 - completed));
+		if (ret == -FI_EAGAIN)
+			continue;
+		CHK_ERR("fi_cq_read", (ret<0), ret);
+
+		for (k=0; k<ret; k++) {
+			if (entry[k].op_context == &ch[0].sctxt)
+				continue;
+			if (!matched++)
+				t1 = when();
+		}
+		completed += ret;
+	}
+
+	return (when() - t1) / (depth - 1);
+}
+
+/* one round, the server returns the us per message it took to match depth messages */
+static double tm_round(int mode, int order, int masked, int depth)
+{
+	double t1 = 0;
+	int dummy = 0;
+
+	if (opt.client) {
+		RECV_MSG(ch[0].rx, &dummy, sizeof(dummy), ch[0].peer_addr, &ch[0].rctxt);
+		WAIT_CQ(ch[0].cq, 1);
+
+		if (mode == TM_EXPECTED) {
+			tm_send_all(depth, masked, 1);
+		}
+		else {
+			/* the marker arrives after all of them */
+			tm_send_all(depth, masked, 0);
+			SEND_MSG(ch[0].tx, &dummy, sizeof(dummy), ch[0].peer_addr, &ch[0].sctxt);
+			WAIT_CQ(ch[0].cq, 1);
+		}
+		return 0;
+	}
+
+	if (mode == TM_EXPECTED) {
+		tm_post_recvs(depth, masked, 0);
+		SEND_MSG(ch[0].tx, &dummy, sizeof(dummy), ch[0].peer_addr, &ch[0].sctxt);
+		return tm_wait_expected(depth);
+	}
+	else {
+		RECV_MSG(ch[0].rx, &dummy, sizeof(dummy), ch[0].peer_addr, &ch[0].rctxt);
+		SEND_MSG(ch[0].tx, &dummy, sizeof(dummy), ch[0].peer_addr, &ch[0].sctxt);
+		WAIT_CQ(ch[0].cq, 2);
+		t1 = when();
+		tm_post_recvs(depth, masked, 1);
+		WAIT_CQ(ch[0].cq, depth);
+	}
+
+	return (when() - t1) / depth;
+}
+
+static void run_tagmatch_test(void)
+{
+	int repeat = sweep.iters ? sweep.iters : 100;
+	int max_depth = TM_MAX_DEPTH;
+	int mode, order, masked, depth, r;
+	double *v, t;
+	char test[64];
+
+	if (fi->rx_attr->size < max_depth)
+		max_depth = fi->rx_attr->size;
+
+	v = malloc(sizeof(double) * repeat);
+	CHK_ERR("malloc", (!v), -ENOMEM);
+
+	synchronize();
+
+	for (mode=TM_EXPECTED; mode<=TM_UNEXPECTED; mode++) {
+		for (masked=0; masked<=1; masked++) {
+			for (order=0; order<TM_NUM_ORDERS; order++) {
+				depth = (mode == TM_EXPECTED) ? 4 : 1;
+				for (; depth<=max_depth; depth*=4) {
+					tm_order(order, depth);
+
+					for (t=0, r=0; r<repeat; r++) {
+						v[r] = tm_round(mode, order, masked, depth);
+						t += v[r];
+					}
+					if (opt.client)
+						continue;
+
+					t /= repeat;
+					printf("tagmatch %-10s %-6s %-7s depth %-5d (x %4d): %8.3lf us/msg\n",
+						mode == TM_EXPECTED ? "expected" : "unexpected",
+						masked ? "masked" : "exact", tm_order_name[order],
+						depth, repeat, t);
+					snprintf(test, sizeof(test), "tagmatch_%s_%s_%s",
+						 mode == TM_EXPECTED ? "expected" : "unexpected",
+						 masked ? "masked" : "exact", tm_order_name[order]);
+					record(test, depth, TM_SIZE, repeat, t, v, repeat, 1, 0);
+				}
+				synchronize();
+			}
+		}
+	}
+
+	free(v);
+}
+
+/****************************
+ *	Multi-receive Test
+ ****************************/
+
+/*
+ * The client streams messages to the server's channel 0 with a window
+ * in flight; the server takes them either with one fi_recv per message,
+ * keeping a window of them posted, or with MRECV_NBUF FI_MULTI_RECV
+ * buffers that each hold many messages and are reposted when the
+ * provider releases them. FI_OPT_MIN_MULTI_RECV is set to the message
+ * size, so a buffer is released once the next message may not fit. The
+ * stream is untagged and the control messages tagged, so the buffers
+ * never take a control message; leftover buffers are cancelled after
+ * each stream.
+ */
+#define MRECV_NBUF	    2
+#define MRECV_BUF_SIZE	    (1<<18)
+#define MRECV_WINDOW	    64
+
+static op_ctx_t mrecv_ctxt[MRECV_NBUF];
+
+static void mrecv_post(int b, char *buf, size_t len)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+	struct fi_msg msg = {
+		.msg_iov = &iov,
+		.iov_count = 1,
+		.addr = FI_ADDR_UNSPEC,
+		.context = &mrecv_ctxt[b],
+	};
+	int ret;
+
+	ret = fi_recvmsg(ch[0].rx, &msg, FI_MULTI_RECV);
+	CHK_ERR("fi_recvmsg", (ret<0), ret);
+}
+
+/* take total messages, return the us from the go message to the last one */
+static double mrecv_serve(int multi, int size, int total, int window, size_t mbuf)
+{
+	struct fi_cq_tagged_entry entry[MRECV_WINDOW + 1];
+	struct fi_cq_err_entry err;
+	int posted = 0, completed = 0, live = 0, go_done = 0;
+	size_t min = size;
+	int fits = (size_t)window * size <= buf_size;	/* else the slots share rbuf */
+	double t1;
+	int dummy = 0;
+	int slot, ret;
+	int b, k;
+
+	if (multi) {
+		ret = fi_setopt((fid_t)ch[0].rx, FI_OPT_ENDPOINT, FI_OPT_MIN_MULTI_RECV,
+				&min, sizeof(min));
+		CHK_ERR("fi_setopt", (ret<0), ret);
+
+		for (b=0; b<MRECV_NBUF; b++)
+			mrecv_post(b, ch[0].rbuf + b * mbuf, mbuf);
+		live = MRECV_NBUF;
+	}
+	else {
+		ctx_reset(0, window);
+	}
+
+	t1 = when();
+	SEND_MSG(ch[0].tx, &dummy, sizeof(dummy), ch[0].peer_addr, &ch[0].sctxt);
+
+	while (completed < total) {
+		/* no more than will be consumed */
+		while (!multi && posted < total && ch[0].nfree) {
+			slot = ctx_get(0);
+			ret = fi_recv(ch[0].rx, ch[0].rbuf + (fits ? (size_t)slot * size : 0),
+				      size, NULL, FI_ADDR_UNSPEC, ctx_of(0, slot));
+			if (ret == -FI_EAGAIN) {
+				ctx_put(0, slot);
+				break;
+			}
+			CHK_ERR("fi_recv", (ret<0), ret);
+			posted++;
+		}
+
+		ret = fi_cq_read(ch[0].cq, entry, MRECV_WINDOW + 1);
+		if (ret == -FI_EAGAIN)
+			continue;
+		CHK_ERR("fi_cq_read", (ret<0), ret);
+
+		for (k=0; k<ret; k++) {
+			if (entry[k].op_context == &ch[0].sctxt) {
+				go_done = 1;
+				continue;
+			}
+
+			if (entry[k].flags & FI_RECV)
+				completed++;
+
+			if (!multi) {
+				ctx_done(0, entry[k].op_context);
+			}
+			else if (entry[k].flags & FI_MULTI_RECV) {
+				b = (op_ctx_t *)entry[k].op_context - mrecv_ctxt;
+				mrecv_post(b, ch[0].rbuf + b * mbuf, mbuf);
+			}
+		}
+	}
+
+	t1 = when() - t1;
+
+	/*
+	 * Wait for the go message to complete and for every buffer still
+	 * posted to be released or cancelled.
+	 */
+	for (b=0; multi && b<MRECV_NBUF; b++)
+		fi_cancel((fid_t)ch[0].rx, &mrecv_ctxt[b]);
+
+	while (!go_done || live) {
+		ret = fi_cq_read(ch[0].cq, entry, 1);
+		if (ret == -FI_EAGAIN)
+			continue;
+		if (ret == -FI_EAVAIL) {
+			ret = fi_cq_readerr(ch[0].cq, &err, 0);
+			CHK_ERR("fi_cq_readerr", (ret<0), ret);
+			CHK_ERR("multi-recv buffer", (err.err != FI_ECANCELED), -err.err);
+			live--;
+			continue;
+		}
+		CHK_ERR("fi_cq_read", (ret<0), ret);
+
+		if (entry[0].op_context == &ch[0].sctxt)
+			go_done = 1;
+		else if (entry[0].flags & FI_MULTI_RECV)
+			live--;
+	}
+
+	return t1;
+}
+
+static void run_mrecv_test(void)
+{
+	struct stream_stats st;
+	int window = opt.window ? opt.window : MRECV_WINDOW;
+	int repeat = sweep.iters ? sweep.iters : 10000;
+	int size, multi, k;
+	int dummy;
+	size_t mbuf, posted_bytes;
+	char test[64];
+	double t;
+
+	if (window > MRECV_WINDOW)
+		window = MRECV_WINDOW;
+
+	synchronize();
+
+	for (k=0; k<sweep.num_sizes; k++) {
+		size = sweep.sizes[k];
+		mbuf = 4 * (size_t)size > MRECV_BUF_SIZE ? 4 * (size_t)size : MRECV_BUF_SIZE;
+
+		for (multi=0; multi<=1; multi++) {
+			if (multi && mbuf * MRECV_NBUF > buf_size)
+				continue;
+
+			if (opt.client) {
+				RECV_MSG(ch[0].rx, &dummy, sizeof(dummy), ch[0].peer_addr,
+					 &ch[0].rctxt);
+				WAIT_CQ(ch[0].cq, 1);
+				stream_send(ch[0].peer_addr, 0, size, repeat, window, &st);
+			}
+			else {
+				t = mrecv_serve(multi, size, repeat, window, mbuf);
+				posted_bytes = multi ? mbuf * MRECV_NBUF : (size_t)size * window;
+				printf("mrecv %-5s %-8d (x %5d): %8.3lf Mmsg/s, %8.2lf MB/s, "
+					"%8zu bytes posted\n", multi ? "multi" : "post", size,
+					repeat, repeat / t, (double)size * repeat / t, posted_bytes);
+				snprintf(test, sizeof(test), "mrecv_%s", multi ? "multi" : "post");
+				record(test, 0, size, repeat, t / repeat, NULL, 0, 1, 0);
+			}
+
+			synchronize();
+		}
+	}
+}
+
+/****************************
+ *	Soak
+ ****************************/
+
+/*
+ * -K <sec>: run the msg or rma write iteration at the first -S size for
+ * <sec> seconds and print throughput and latency percentiles for every
+ * -I interval. Each thread counts its iterations into histograms of its
+ * own, one per interval in a ring of SOAK_SLOTS, with no locks on the
+ * way. A batch of iterations ends with a barrier and the client's choice
+ * of the next batch size, and that is where the leader reads and clears
+ * the finished intervals of all threads. Batches are kept well below an
+ * interval, so the other threads never reach a slot being cleared. An
+ * iteration that ends SOAK_SLOTS or more intervals past the last one
+ * printed, after a stall, would wrap onto a slot still in use; it goes
+ * to an extra slot instead, printed on a line of its own.
+ */
+
+#define SOAK_BATCH_TIME	    10000.0	/* us per batch at most */
+#define SOAK_MAX_BATCH	    (1 << 20)
+
+/* log-linear bucket of t us in ns, exact below 2^SOAK_SUB_BITS ns */
+static inline int soak_bucket(double t)
+{
+	uint64_t ns = t * 1000;
+	int b;
+
+	if (ns < (1 << SOAK_SUB_BITS))
+		return ns;
+
+	b = 63 - __builtin_clzll(ns);
+	return ((b - SOAK_SUB_BITS + 1) << SOAK_SUB_BITS) +
+	       ((ns >> (b - SOAK_SUB_BITS)) & ((1 << SOAK_SUB_BITS) - 1));
+}
+
+/* lower bound of bucket k in us */
+static inline double soak_value(int k)
+{
+	int e = k >> SOAK_SUB_BITS;
+	uint64_t m = k & ((1 << SOAK_SUB_BITS) - 1);
+
+	if (!e)
+		return m / 1000.0;
+	return (double)(((1 << SOAK_SUB_BITS) + m) << (e - 1)) / 1000.0;
+}
+
+static double soak_percentile(const struct soak_acc *a, double q)
+{
+	uint64_t want = q * a->n, seen = 0;
+	int k;
+
+	for (k=0; k<SOAK_BUCKETS; k++) {
+		seen += a->hist[k];
+		if (seen > want)
+			return soak_value(k);
+	}
+	return a->max;
+}
+
+/* leader: merge slot s of all threads into all and clear it */
+static void soak_collect(int s, struct soak_acc *all)
+{
+	struct soak_acc *a;
+	int nthreads = opt.threads ? opt.num_ch : 1;
+	int i, k;
+
+	memset(all, 0, sizeof(*all));
+	for (i=0; i<nthreads; i++) {
+		a = &soak.acc[i][s];
+		all->n += a->n;
+		all->sum += a->sum;
+		if (a->max > all->max)
+			all->max = a->max;
+		for (k=0; k<SOAK_BUCKETS; k++)
+			all->hist[k] += a->hist[k];
+		memset(a, 0, sizeof(*a));
+	}
+}
+
+/* leader: the iterations that ended past the ring, see soak_run() */
+static void soak_print_late(void)
+{
+	struct soak_acc all;
+
+	soak_collect(SOAK_SLOTS, &all);
+	if (!all.n)
+		return;
+
+	printf("soak late: %" PRIu64 " iterations ended %d or more intervals after "
+		"interval %ld, lat us mean %8.2lf max %8.2lf\n",
+		all.n, SOAK_SLOTS, soak.printed, all.sum / all.n, all.max);
+}
+
+/* leader: print and clear interval e of all threads, len us long */
+static void soak_print(long e, double len, int size, int div)
+{
+	struct soak_acc all;
+	int ch_per_thread = opt.threads ? 1 : opt.num_ch;
+	long errors;
+
+	soak_collect(e % SOAK_SLOTS, &all);
+	if (!all.n || len <= 0)
+		return;
+
+	printf("soak %8.1lf s: %10.0lf iter/s, %9.2lf MB/s, lat us mean %8.2lf "
+		"p50 %8.2lf p99 %8.2lf p99.9 %8.2lf max %8.2lf",
+		(e * soak.interval + len) / 1e6,
+		all.n * ch_per_thread / len * 1e6,
+		(double)all.n * ch_per_thread * div * size / len,
+		all.sum / all.n, soak_percentile(&all, 0.5), soak_percentile(&all, 0.99),
+		soak_percentile(&all, 0.999), all.max);
+
+	if (opt.verify) {
+		errors = verify_errors();
+		printf(", %ld errors", errors - soak.errors);
+		soak.errors = errors;
+	}
+	printf("\n");
+}
+
+static void soak_run(iter_fn_t fn, int size, int div)
+{
+	double start, prev, now, t, batch_start;
+	struct soak_acc *a;
+	long e;
+	int batch = 1, next;
+	int k;
+
+	if (LEADER) {
+		soak.acc = calloc(opt.threads ? opt.num_ch : 1, sizeof(*soak.acc));
+		CHK_ERR("calloc", (!soak.acc), -ENOMEM);
+		soak.printed = 0;
+	}
+	barrier();
+
+	start = prev = batch_start = when();
+
+	while (batch) {
+		for (k=0; k<batch; k++) {
+			fn(size, 0);
+			now = when();
+			t = (now - prev) / div;
+			prev = now;
+
+			e = (now - start) / soak.interval;
+			if (e >= soak.printed + SOAK_SLOTS)
+				a = &soak.acc[ch_first][SOAK_SLOTS];
+			else
+				a = &soak.acc[ch_first][e % SOAK_SLOTS];
+			a->n++;
+			a->sum += t;
+			if (t > a->max)
+				a->max = t;
+			a->hist[soak_bucket(t)]++;
+		}
+		barrier();
+
+		now = when();
+		next = 0;
+		if (LEADER) {
+			soak_print_late();
+			for (e = (now - start) / soak.interval; soak.printed < e; soak.printed++)
+				soak_print(soak.printed, soak.interval, size, div);
+
+			/* the next batch takes about a tenth of an interval */
+			t = soak.interval / 10 < SOAK_BATCH_TIME ? soak.interval / 10 : SOAK_BATCH_TIME;
+			next = batch * t / (now - batch_start);
+			if (next < 1)
+				next = 1;
+			if (next > SOAK_MAX_BATCH)
+				next = SOAK_MAX_BATCH;
+			if (now - start >= soak.duration)
+				next = 0;
+		}
+		batch = leader_agree(next);
+		prev = batch_start = when();
+	}
+
+	if (LEADER) {
+		soak_print_late();
+		e = (now - start) / soak.interval;
+		for (; soak.printed <= e; soak.printed++)
+			soak_print(soak.printed, soak.printed < e ? soak.interval :
+				   now - start - e * soak.interval, size, div);
+		free(soak.acc);
+	}
+	barrier();
+}
+
+static void run_soak_test(void)
+{
+	int size = sweep.sizes[0];
+
+	if (LEADER)
+		printf("soak %s %d bytes for %.0lf s, every %.0lf ms\n",
+			opt.test_type == TEST_RMA ? "write" : opt.tag ? "tagged" : "msg",
+			size, soak.duration / 1e6, soak.interval / 1e3);
+
+	if (opt.test_type == TEST_RMA) {
+		exchange_rma_info();
+		synchronize();
+		soak_run(write_iter, size, 1);
+		synchronize();
+	}
+	else {
+		soak_run(msg_iter, size, 2);
+	}
+}
+
+/****************************
+ *	Discovery
+ ****************************/
+
+/*
+ * -D: probe every fi_info the options match, across providers, domains
+ * and endpoint types, with a loopback ping-pong like -s. Each probe runs
+ * in a child process, so a combination that fails or hangs only costs
+ * its own row.
+ */
+
+#define DISCOVER_LAT_SIZE   8
+#define DISCOVER_BW_SIZE    (1<<20)
+#define DISCOVER_TIMEOUT    30		/* s per probe */
+
+#define PROBE_OK	    0
+#define PROBE_SKIPPED	    1		/* loopback needs FI_EP_RDM */
+#define PROBE_FAILED	    2
+#define PROBE_TIMEOUT	    3
+
+static const char *probe_status[] = {
+	"ok", "not probed", "failed", "timed out"
+};
+
+struct probe {
+	struct fi_info	*info;
+	double		lat;		/* us, one way */
+	double		bw;		/* MB/s */
+	int		status;
+};
+
+/* the child: open info as with -s, time both sizes, report through fd */
+static void probe_child(struct fi_info *info, int fd)
+{
+	double t[2];
+	int repeat;
+
+	alarm(DISCOVER_TIMEOUT);
+	if (!freopen("/dev/null", "w", stdout) || !freopen("/dev/null", "w", stderr))
+		exit(1);
+
+	opt.self = opt.client = opt.bidir = 1;
+	opt.num_ch = 1;
+	opt.threads = 0;
+	ch_first = 0;
+	ch_last = 1;
+
+	fi = fi_dupinfo(info);
+	CHK_ERR("fi_dupinfo", (!fi), -ENOMEM);
+
+	init_buffer();
+	open_fabric();
+	get_peer_address();
+
+	t[0] = run_point(msg_iter, DISCOVER_LAT_SIZE, 0, DISCOVER_LAT_SIZE,
+			 POINT_PAIRED, &repeat) / 2;
+	t[1] = DISCOVER_BW_SIZE / (run_point(msg_iter, DISCOVER_BW_SIZE, 0,
+			 DISCOVER_BW_SIZE, POINT_PAIRED, &repeat) / 2);
+
+	if (write(fd, t, sizeof(t)) != sizeof(t))
+		exit(1);
+
+	finalize_fabric();
+	exit(0);
+}
+
+static void probe_one(struct probe *p)
+{
+	double t[2];
+	pid_t pid;
+	int fd[2];
+	int status, got;
+
+	if (p->info->ep_attr->type != FI_EP_RDM) {
+		p->status = PROBE_SKIPPED;
+		return;
+	}
+
+	CHK_ERR("pipe", (pipe(fd)), -errno);
+	fflush(stdout);
+
+	pid = fork();
+	CHK_ERR("fork", (pid<0), -errno);
+	if (!pid) {
+		close(fd[0]);
+		probe_child(p->info, fd[1]);
+	}
+
+	close(fd[1]);
+	got = (read(fd[0], t, sizeof(t)) == sizeof(t));
+	close(fd[0]);
+	waitpid(pid, &status, 0);
 
-			printf("read  %-8d (x %4d): ", size, repeat);
-			fflush(stdout);
-			t1 = when();
-			for (i=0; i<repeat; i++) {
-				//reset_one(size);
-				read_one(size);
-				//poll_one(size);
-			}
-			t2 = when();
-			t = (t2 - t1) / repeat;
-			printf("%8.2lf us, %8.2lf MB/s\n", t, size/t);
-		}
+	if (got) {
+		p->status = PROBE_OK;
+		p->lat = t[0];
+		p->bw = t[1];
+	}
+	else if (WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM) {
+		p->status = PROBE_TIMEOUT;
+	}
+	else {
+		p->status = PROBE_FAILED;
 	}
-	
-	synchronize();
 }
 
-/****************************
- *	Atomic Test
- ****************************/
-
-static void atomic_one(int type, int op, int count)
+/* by latency, what could not be probed last */
+static int cmp_probe(const void *a, const void *b)
 {
-	int ret;
-	int i;
-
-	for (i=0; i<opt.num_ch; i++) {
-		ret = fi_atomic(ch[i].ep, ch[i].sbuf, count, NULL,
-				ch[i].peer_addr,
-				ch[i].peer_rma_info.rbuf_addr,
-				ch[i].peer_rma_info.rbuf_key, 
-				type, op, &ch[i].sctxt);
-		CHK_ERR("fi_atomic", (ret<0), ret);
+	const struct probe *x = a, *y = b;
 
-		WAIT_CQ(ch[i].cq, 1);
-	}
+	if (x->status != y->status)
+		return x->status - y->status;
+	return (x->lat > y->lat) - (x->lat < y->lat);
 }
 
-static void fetch_atomic_one(int type, int op, int count)
+static void run_discovery(void)
 {
-	int ret;
-	int i;
+	struct fi_info *hints, *list, *info;
+	struct probe *p = NULL;
+	int n = 0;
+	int err, k;
 
-	for (i=0; i<opt.num_ch; i++) {
-		ret = fi_fetch_atomic(ch[i].ep, ch[i].sbuf, count, NULL,
-				ch[i].rbuf, NULL,
-				ch[i].peer_addr,
-				ch[i].peer_rma_info.rbuf_addr,
-				ch[i].peer_rma_info.rbuf_key, 
-				type, op, &ch[i].rctxt);
-		CHK_ERR("fi_fetch_atomic", (ret<0), ret);
+	hints = get_hints();
+	hints->ep_attr->type = FI_EP_UNSPEC;
 
-		WAIT_CQ(ch[i].cq, 1);
+	err = fi_getinfo(api_version(), NULL, NULL, 0, hints, &list);
+	CHK_ERR("fi_getinfo", (err<0), err);
+	fi_freeinfo(hints);
+
+	for (info = list; info; info = info->next) {
+		p = realloc(p, (n + 1) * sizeof(*p));
+		CHK_ERR("realloc", (!p), -ENOMEM);
+		memset(&p[n], 0, sizeof(*p));
+		p[n].info = info;
+
+		printf("probing %s / %s / %s ...\n", info->fabric_attr->prov_name,
+			info->domain_attr->name, fi_tostr(&info->ep_attr->type, FI_TYPE_EP_TYPE));
+		probe_one(&p[n++]);
+	}
+
+	qsort(p, n, sizeof(*p), cmp_probe);
+
+	printf("\n%4s  %-24s %-16s %-12s %12s %12s\n", "rank", "provider", "domain",
+		"ep_type", "lat (us)", "bw (MB/s)");
+	for (k=0; k<n; k++) {
+		info = p[k].info;
+		if (p[k].status == PROBE_OK)
+			printf("%4d  %-24s %-16s %-12s %12.2lf %12.2lf\n", k + 1,
+				info->fabric_attr->prov_name, info->domain_attr->name,
+				fi_tostr(&info->ep_attr->type, FI_TYPE_EP_TYPE),
+				p[k].lat, p[k].bw);
+		else
+			printf("%4s  %-24s %-16s %-12s %25s\n", "-",
+				info->fabric_attr->prov_name, info->domain_attr->name,
+				fi_tostr(&info->ep_attr->type, FI_TYPE_EP_TYPE),
+				probe_status[p[k].status]);
 	}
+
+	free(p);
+	fi_freeinfo(list);
 }
 
-static void run_atomic_test(void)
+/****************************
+ *	Main
+ ****************************/
+
+static void run_test(void)
 {
-	size_t count;
-	size_t max_count;
-	double t1, t2, t;
-	int repeat, i, n;
+	if (soak.duration) {
+		run_soak_test();
+		return;
+	}
 
-	exchange_rma_info();
+	switch (opt.test_type) {
+	case TEST_MSG:
+		if (opt.ep_type == FI_EP_DGRAM)
+			run_dgram_test();
+		else
+			run_msg_test();
+		break;
 
-	synchronize();
+	case TEST_RMA:
+		run_rma_test();
+		break;
 
-	if (!fi_atomicvalid(ch[0].ep, FI_UINT64, FI_ATOMIC_WRITE, &max_count)) {
-		for (count = 1; count <= max_count; count = count << 1) {
-			repeat = 1000;
-			n = (count * sizeof(uint64_t)) >> 16;
-			while (n) {
-				repeat >>= 1;
-				n >>= 1;
-			}
+	case TEST_ATOMIC:
+		run_atomic_test();
+		break;
 
-			printf("atomic write u64x%-4d (x %4d): ", count, repeat);
-			fflush(stdout);
-			t1 = when();
-			for (i=0; i<repeat; i++) {
-				if (opt.client) {
-					atomic_one(FI_UINT64, FI_ATOMIC_WRITE, count);
-					if (opt.bidir)
-						wait_one();
-				}
-				else {
-					wait_one();
-					 if (opt.bidir) {
-						atomic_one(FI_UINT64, FI_ATOMIC_WRITE, count);
-					}
-				}
-			}
-			t2 = when();
-			t = (t2 - t1) / repeat;
-			printf("%8.2lf us, %8.2lf MB/s\n", t, (count * sizeof(uint64_t))/t);
-		}
-	}
+	case TEST_IOV:
+		run_iov_test();
+		break;
 
-	synchronize();
+	case TEST_INCAST:
+		run_incast_test();
+		break;
 
-	if (!fi_fetch_atomicvalid(ch[0].ep, FI_UINT64, FI_ATOMIC_READ, &max_count)) {
-		if (opt.client || opt.bidir) {
-			for (count = 1; count <= max_count; count = count << 1) {
-				repeat = 1000;
-				n = (count * sizeof(uint64_t)) >> 16;
-				while (n) {
-					repeat >>= 1;
-					n >>= 1;
-				}
+	case TEST_ALLTOALL:
+		run_alltoall_test();
+		break;
 
-				printf("atomic read u64x%-4d (x %4d): ", count, repeat);
-				fflush(stdout);
-				t1 = when();
-				for (i=0; i<repeat; i++) {
-					fetch_atomic_one(FI_UINT64, FI_ATOMIC_READ, count);
-				}
-				t2 = when();
-				t = (t2 - t1) / repeat;
-				printf("%8.2lf us, %8.2lf MB/s\n", t, (count * sizeof(uint64_t))/t);
-			}
-		}
+	case TEST_ALLREDUCE:
+		run_allreduce_test();
+		break;
+
+	case TEST_BCAST:
+		run_bcast_test();
+		break;
+
+	case TEST_TAGMATCH:
+		run_tagmatch_test();
+		break;
+
+	case TEST_MRECV:
+		run_mrecv_test();
+		break;
 	}
-	
-	synchronize();
 }
 
-/****************************
- *	Main
- ****************************/
+/* opt.threads: thread i drives channel i from CPU i */
+static void *run_thread(void *arg)
+{
+	cpu_set_t cpuset;
+	int i = (int)(long)arg;
+
+	ch_first = i;
+	ch_last = i + 1;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(i, &cpuset);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+
+	run_test();
+	return NULL;
+}
 
 void print_usage(void)
 {
-	printf("Usage: pingpong [-b][-c <num_channels>][-f <provider>][-t <test_type>]"
-		" [server_name]\n"); 
+	printf("Usage: pingpong [-a <schedule>][-b][-m][-C][-d][-D][-v][-c <num_channels>][-f <provider>][-t <test_type>][-w <window>]"
+		"\n\t\t[-e <ep_type>][-V <version>][-M <mode>][-l <layout>][-P][-s][-G][-N <ranks> [-F]][-S <sizes>][-n <iters>][-W <warmup>]"
+		"\n\t\t[-T <msec>][-E <percent>][-K <sec> [-I <msec>]][-o <format>:<file>][-B <file>][-R <percent>] [server_name]\n");
 	printf("Options:\n");
 	printf("\t-b\t\t\tbidirectional test (RMA test only)\n");
+	printf("\t-C\t\t\tall channels contend on one remote word (atomic test only)\n");
+	printf("\t-d\t\t\tbisect the sweep for protocol switches, e.g. eager to\n");
+	printf("\t\t\t\trendezvous (msg/tagged and rma write)\n");
+	printf("\t-D\t\t\tprobe every provider/domain/endpoint type that fits the\n");
+	printf("\t\t\t\tother options by loopback and rank them (no server_name)\n");
+	printf("\t-v\t\t\tfill every payload with a pattern and check it on arrival,\n");
+	printf("\t\t\t\treport the cost per point and exit with status 3 on bad\n");
+	printf("\t\t\t\tdata (msg/tagged, and rma write with -b)\n");
 	printf("\t-c <num_channels>\ttest over multiple channels concurrently\n");
 	printf("\t-f <provider>\t\tuse the specific provider\n");
+	printf("\t-m\t\t\trun every valid atomic op/datatype combination (atomic test only)\n");
 	printf("\t-t <test_type>\t\tperform the spcified test, <test_type> can be:\n");
 	printf("\t\t\t\tmsg ------- non-tagged send/receive\n");
 	printf("\t\t\t\ttagged ---- tagged send/receive\n");
 	printf("\t\t\t\trma ------- RMA read/write\n");
 	printf("\t\t\t\tatomic ---- atomic read/write\n");
+	printf("\t\t\t\tiov ------- scatter-gather send/recv/write/read vs. packing\n");
+	printf("\t\t\t\tincast ---- ranks 1..m stream to rank 0 for growing m (with -N)\n");
+	printf("\t\t\t\talltoall -- personalized all-to-all exchange (with -N)\n");
+	printf("\t\t\t\tallreduce - ring and recursive doubling sum (with -N)\n");
+	printf("\t\t\t\tbcast ----- chunked RMA broadcast down a flat, chain or\n");
+	printf("\t\t\t\t            binary tree (with -N)\n");
+	printf("\t\t\t\ttagmatch -- tagged matching cost vs. queue depth, expected\n");
+	printf("\t\t\t\t            and unexpected (channel 0, not with -N/-s)\n");
+	printf("\t\t\t\tmrecv ----- message rate with per-message receives vs.\n");
+	printf("\t\t\t\t            FI_MULTI_RECV buffers (channel 0, not with -N/-s)\n");
+	printf("\t-a <schedule>\t\tall-to-all schedule: naive, pairwise (-w steps in flight)\n");
+	printf("\t\t\t\tor bruck (blocks up to %d bytes), default all\n", BRUCK_MAX_SIZE);
+	printf("\t-e <ep_type>\t\tendpoint type, <ep_type> can be:\n");
+	printf("\t\t\t\trdm ------- reliable unconnected (default)\n");
+	printf("\t\t\t\tmsg ------- connected, one connection per channel\n");
+	printf("\t\t\t\tdgram ----- unreliable, the msg test streams numbered\n");
+	printf("\t\t\t\t            datagrams and reports loss (channel 0 only)\n");
+	printf("\t-V <version>\t\task for API <major>.<minor> instead of the newest one\n");
+	printf("\t\t\t\tthe library and headers support\n");
+	printf("\t-M <mode>\t\tcontext mode offered, <mode> can be:\n");
+	printf("\t\t\t\tcontext --- FI_CONTEXT/FI_CONTEXT2 if the provider wants (default)\n");
+	printf("\t\t\t\tnone ------ no per-op context storage for the provider\n");
+	printf("\t-l <layout>\t\tendpoint layout of the channels, <layout> can be:\n");
+	printf("\t\t\t\tep -------- one endpoint per channel (default)\n");
+	printf("\t\t\t\tsep ------- one scalable endpoint, a tx/rx context per channel\n");
+	printf("\t\t\t\tshared ---- one endpoint per channel over a shared tx/rx context\n");
+	printf("\t-P\t\t\tdrive each channel from its own thread pinned to CPU <channel>\n");
+	printf("\t-s\t\t\tloopback within one process, no server_name\n");
+	printf("\t-N <ranks>\t\trun <ranks> processes, all pairs concurrently; rank 0 is\n");
+	printf("\t\t\t\tstarted without server_name, the others with its host\n");
+	printf("\t-F\t\t\tfork all <ranks> on this node (with -N, no server_name)\n");
+	printf("\t-G\t\t\tuse the generic per-iteration loops instead of the ones\n");
+	printf("\t\t\t\tspecialized per operation, tag and side (msg/rma tests),\n");
+	printf("\t\t\t\tand the scalar allreduce and verify kernels\n");
+	printf("\t-w <window>\t\tkeep <window> atomics outstanding per channel (atomic test only)\n");
+	printf("\t-S <sizes>\t\tmessage sizes, comma separated sizes or ranges <first>-<last>\n");
+	printf("\t\t\t\t[:x<factor>|:+<step>], e.g. 1-4m,100,6m-64m:+2m (default 1-4m)\n");
+	printf("\t-n <iters>\t\titerations per size (minimum iterations with -T/-E)\n");
+	printf("\t-W <warmup>\t\tuntimed warmup iterations per size\n");
+	printf("\t-T <msec>\t\tadapt iterations to run about <msec> per size\n");
+	printf("\t-E <percent>\t\tadapt iterations until the 95%% confidence interval of the\n");
+	printf("\t\t\t\tmean is within +/-<percent> (bounded by -T, default 10s)\n");
+	printf("\t\t\t\t(-W/-T/-E: not with -C, atomic -w, incast or mrecv, which run\n");
+	printf("\t\t\t\ta fixed -n count)\n");
+	printf("\t-K <sec>\t\tsoak: run the first of -S for <sec> seconds and print\n");
+	printf("\t\t\t\tthroughput and latency percentiles per interval (msg/tagged\n");
+	printf("\t\t\t\tand rma write)\n");
+	printf("\t-I <msec>\t\tsoak interval (default 1000)\n");
+	printf("\t-o <format>:<file>\twrite results with latency percentiles to <file> ('-' for\n");
+	printf("\t\t\t\tstdout, the console output then goes to stderr), <format>\n");
+	printf("\t\t\t\tis json (one object per line) or csv\n");
+	printf("\t-B <file>\t\tcompare with the JSON results in <file> from an earlier run with\n");
+	printf("\t\t\t\tthe same options, exit with status 2 if any point regressed\n");
+	printf("\t-R <percent>\t\tslowdown that counts as a regression (default 5)\n");
 }
 
 int main(int argc, char *argv[])
 {
-	int c;
+	int regressed;
+	int major, minor;
+	int c, k;
 
-	while ((c = getopt(argc, argv, "bc:f:t:")) != -1) {
+	while ((c = getopt(argc, argv, "a:B:bCc:dDe:E:Ff:GI:K:l:mM:N:n:o:PR:sS:t:T:vV:w:W:")) != -1) {
 		switch (c) {
+		case 'a':
+			opt.schedule = -1;
+			for (k=0; k<A2A_NUM; k++)
+				if (strcmp(optarg, a2a_name[k]) == 0)
+					opt.schedule = k;
+			if (opt.schedule < 0) {
+				print_usage();
+				exit(1);
+			}
+			break;
+
+		case 'B':
+			baseline.path = strdup(optarg);
+			break;
+
 		case 'b':
 			opt.bidir = 1;
 			break;
 
+		case 'C':
+			opt.contend = 1;
+			break;
+
 		case 'c':
 			opt.num_ch = atoi(optarg);
 			if (opt.num_ch <= 0 || opt.num_ch > MAX_NUM_CHANNELS) {
@@ -774,10 +6486,139 @@ int main(int argc, char *argv[])
 			}
 			break;
 
+		case 'd':
+			opt.detect = 1;
+			break;
+
+		case 'D':
+			opt.discover = 1;
+			break;
+
+		case 'e':
+			if (strcmp(optarg, "rdm") == 0)
+				opt.ep_type = FI_EP_RDM;
+			else if (strcmp(optarg, "msg") == 0)
+				opt.ep_type = FI_EP_MSG;
+			else if (strcmp(optarg, "dgram") == 0)
+				opt.ep_type = FI_EP_DGRAM;
+			else {
+				print_usage();
+				exit(1);
+			}
+			break;
+
+		case 'E':
+			sweep.target_ci = atof(optarg) / 100;
+			if (sweep.target_ci <= 0) {
+				printf("The confidence interval must be positive\n");
+				exit(1);
+			}
+			break;
+
 		case 'f':
 			opt.prov_name = strdup(optarg);
 			break;
 
+		case 'F':
+			opt.fork = 1;
+			break;
+
+		case 'G':
+			opt.generic = 1;
+			break;
+
+		case 'I':
+			soak.interval = atof(optarg) * 1000;
+			if (soak.interval <= 0) {
+				printf("The soak interval must be positive\n");
+				exit(1);
+			}
+			break;
+
+		case 'K':
+			soak.duration = atof(optarg) * 1e6;
+			if (soak.duration <= 0) {
+				printf("The soak duration must be positive\n");
+				exit(1);
+			}
+			break;
+
+		case 'l':
+			if (strcmp(optarg, "ep") == 0)
+				opt.layout = LAYOUT_EP;
+			else if (strcmp(optarg, "sep") == 0)
+				opt.layout = LAYOUT_SEP;
+			else if (strcmp(optarg, "shared") == 0)
+				opt.layout = LAYOUT_SHARED;
+			else {
+				print_usage();
+				exit(1);
+			}
+			break;
+
+		case 'm':
+			opt.matrix = 1;
+			break;
+
+		case 'M':
+			if (strcmp(optarg, "none") == 0)
+				opt.no_context = 1;
+			else if (strcmp(optarg, "context") == 0)
+				opt.no_context = 0;
+			else {
+				print_usage();
+				exit(1);
+			}
+			break;
+
+		case 'n':
+			sweep.iters = atoi(optarg);
+			if (sweep.iters <= 0) {
+				printf("The number of iterations must be positive\n");
+				exit(1);
+			}
+			break;
+
+		case 'N':
+			opt.ranks = atoi(optarg);
+			if (opt.ranks < 2 || opt.ranks > MAX_NUM_CHANNELS + 1) {
+				printf("The number of ranks must be 2~%d\n", MAX_NUM_CHANNELS + 1);
+				exit(1);
+			}
+			break;
+
+		case 'o':
+			parse_result_spec(optarg);
+			break;
+
+		case 'P':
+			opt.threads = 1;
+			break;
+
+		case 'R':
+			baseline.threshold = atof(optarg) / 100;
+			if (baseline.threshold < 0) {
+				printf("The regression threshold must not be negative\n");
+				exit(1);
+			}
+			break;
+
+		case 's':
+			opt.self = 1;
+			break;
+
+		case 'S':
+			parse_sizes(optarg);
+			break;
+
+		case 'T':
+			sweep.target_time = atof(optarg) * 1000;
+			if (sweep.target_time <= 0) {
+				printf("The target time must be positive\n");
+				exit(1);
+			}
+			break;
+
 		case 't':
 			if (strcmp(optarg, "msg") == 0) {
 				opt.test_type = TEST_MSG;
@@ -795,12 +6636,71 @@ int main(int argc, char *argv[])
 				opt.test_type = TEST_ATOMIC;
 				opt.tag = 0;
 			}
+			else if (strcmp(optarg, "iov") == 0) {
+				opt.test_type = TEST_IOV;
+				opt.tag = 0;
+			}
+			else if (strcmp(optarg, "incast") == 0) {
+				opt.test_type = TEST_INCAST;
+				opt.tag = 0;
+			}
+			else if (strcmp(optarg, "alltoall") == 0) {
+				opt.test_type = TEST_ALLTOALL;
+				opt.tag = 0;
+			}
+			else if (strcmp(optarg, "allreduce") == 0) {
+				opt.test_type = TEST_ALLREDUCE;
+				opt.tag = 0;
+			}
+			else if (strcmp(optarg, "bcast") == 0) {
+				opt.test_type = TEST_BCAST;
+				opt.tag = 0;
+			}
+			else if (strcmp(optarg, "tagmatch") == 0) {
+				opt.test_type = TEST_TAGMATCH;
+				opt.tag = 1;
+			}
+			else if (strcmp(optarg, "mrecv") == 0) {
+				/* tagged control messages stay out of the multi-recv buffers */
+				opt.test_type = TEST_MRECV;
+				opt.tag = 1;
+			}
 			else {
 				print_usage();
 				exit(1);
 			}
 			break;
 
+		case 'v':
+			opt.verify = 1;
+			break;
+
+		case 'V':
+			if (sscanf(optarg, "%d.%d", &major, &minor) != 2 ||
+			    FI_VERSION(major, minor) > HDR_VERSION) {
+				printf("The API version must be <major>.<minor>, at most %d.%d\n",
+					FI_MAJOR_VERSION, FI_MINOR_VERSION);
+				exit(1);
+			}
+			opt.api_version = FI_VERSION(major, minor);
+			break;
+
+		case 'w':
+			opt.window = atoi(optarg);
+			if (opt.window <= 0 || opt.window > MAX_WINDOW) {
+				printf("The window must be 1~%d\n", MAX_WINDOW);
+				exit(1);
+			}
+			break;
+
+		case 'W':
+			sweep.warmup = atoi(optarg);
+			if (sweep.warmup < 0) {
+				printf("The warmup count must not be negative\n");
+				exit(1);
+			}
+			break;
+
 		default:
 			print_usage();
 			exit(1);
@@ -809,32 +6709,158 @@ int main(int argc, char *argv[])
 	}
 
 	if (argc > optind) {
+		if (opt.self) {
+			print_usage();
+			exit(1);
+		}
 		opt.client = 1;
 		opt.server_name = strdup(argv[optind]);
 	}
 
+	/* loopback: this process is both sides, so every test runs both ways */
+	if (opt.self) {
+		opt.client = 1;
+		opt.bidir = 1;
+	}
+
+	if (opt.ranks) {
+		if (opt.layout != LAYOUT_EP || opt.threads || opt.self || opt.contend) {
+			printf("-N runs with one thread and the ep layout, without -s or -C\n");
+			exit(1);
+		}
+		if (opt.fork && opt.server_name) {
+			print_usage();
+			exit(1);
+		}
+		opt.num_ch = opt.ranks - 1;
+		opt.client = 1;
+		opt.bidir = 1;
+	}
+	else if (opt.fork || RANK_TEST(opt.test_type)) {
+		print_usage();
+		exit(1);
+	}
+
+	if (opt.ep_type == FI_EP_MSG && (opt.ranks || opt.self || opt.layout != LAYOUT_EP)) {
+		printf("-e msg runs with the ep layout, without -N or -s\n");
+		exit(1);
+	}
+
+	if (opt.ep_type == FI_EP_DGRAM &&
+	    (opt.test_type != TEST_MSG || opt.tag || opt.num_ch > 1 || opt.ranks ||
+	     opt.self || opt.layout != LAYOUT_EP)) {
+		printf("-e dgram runs the msg test on one channel, without -N or -s\n");
+		exit(1);
+	}
+
+	if ((opt.test_type == TEST_TAGMATCH || opt.test_type == TEST_MRECV) &&
+	    (opt.ranks || opt.self)) {
+		print_usage();
+		exit(1);
+	}
+
+	/* these run a fixed count of their own, only -n sets it */
+	if (((opt.test_type == TEST_ATOMIC && (opt.contend || opt.window)) ||
+	     opt.test_type == TEST_INCAST || opt.test_type == TEST_MRECV) &&
+	    (sweep.warmup || sweep.target_time || sweep.target_ci)) {
+		printf("-C, atomic -w, incast and mrecv run a fixed count set with -n, "
+		       "without -W, -T or -E\n");
+		exit(1);
+	}
+
+	if (opt.verify && ((opt.test_type != TEST_MSG && opt.test_type != TEST_RMA) ||
+			   opt.ep_type == FI_EP_DGRAM)) {
+		printf("-v checks the msg, tagged and rma tests\n");
+		exit(1);
+	}
+
+	/* one-way writes would overwrite rbuf while it is being checked */
+	if (opt.verify && opt.test_type == TEST_RMA && !opt.bidir) {
+		printf("-v checks the rma test with -b\n");
+		exit(1);
+	}
+
+	if (soak.duration && ((opt.test_type != TEST_MSG && opt.test_type != TEST_RMA) ||
+			      opt.ep_type == FI_EP_DGRAM)) {
+		printf("-K soaks the msg, tagged and rma tests\n");
+		exit(1);
+	}
+
+	if (opt.discover && (opt.server_name || opt.ranks)) {
+		print_usage();
+		exit(1);
+	}
+
+	/* records on stdout take it over, the console output goes to stderr */
+	if (result.format && strcmp(result.path, "-") == 0) {
+		result.fp = fdopen(dup(STDOUT_FILENO), "w");
+		if (!result.fp || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+			perror("stdout");
+			exit(1);
+		}
+	}
+
+	init_sweep();
 	print_options();
+
+	if (opt.discover) {
+		run_discovery();
+		return 0;
+	}
+	load_baseline();
+	if (opt.fork)
+		fork_ranks();
 	init_buffer();
 	init_fabric();
+	if (opt.fork && !opt.server_name)
+		release_ranks();
 	get_peer_address();
 
-	switch (opt.test_type) {
-	case TEST_MSG:
-		run_msg_test();
-		break;
+	/* only rank 0 writes and compares results */
+	if (opt.rank) {
+		result.format = RESULT_NONE;
+		baseline.path = NULL;
+	}
+	init_result(argc, argv);
+	init_pack_kernel();
+	init_verify_kernel();
+	when();		/* set the clock origin before any thread reads it */
 
-	case TEST_RMA:
-		run_rma_test();
-		break;
+	if (opt.threads) {
+		pthread_t threads[MAX_NUM_CHANNELS];
+		int i, err;
 
-	case TEST_ATOMIC:
-		run_atomic_test();
-		break;
+		pthread_barrier_init(&thread_barrier, NULL, opt.num_ch);
+		for (i=0; i<opt.num_ch; i++) {
+			err = pthread_create(&threads[i], NULL, run_thread,
+					     (void *)(long)i);
+			CHK_ERR("pthread_create", (err), -err);
+		}
+		for (i=0; i<opt.num_ch; i++)
+			pthread_join(threads[i], NULL);
+		pthread_barrier_destroy(&thread_barrier);
+	}
+	else {
+		ch_first = 0;
+		ch_last = opt.num_ch;
+		run_test();
 	}
 
+	regressed = finalize_baseline();
+	finalize_result();
 	finalize_fabric();
 	free_buffer();
 
-	return 0;
+	if (opt.fork && !opt.rank && wait_ranks()) {
+		fprintf(stderr, "some ranks failed\n");
+		return 1;
+	}
+
+	if (verify_errors()) {
+		fprintf(stderr, "%ld payloads failed verification\n", verify_errors());
+		return 3;
+	}
+
+	return regressed ? 2 : 0;
 }
 